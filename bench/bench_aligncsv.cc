@@ -0,0 +1,248 @@
+// Filename: bench_aligncsv.cc
+// Purpose: time each phase of aligncsv on a set of files
+// Usage: bench_aligncsv [-d <diff>] [-1] [-m] [-r] [-l] [-n <repeats>]
+//                       <filename>+
+//        -d, -1, -m, -r and -l are as for aligncsv
+//        -n <repeats> run everything this many times and report the
+//           fastest time of each phase (default 3)
+//        the tokenizer's cpu kernel is the best the processor has, unless
+//           ALIGNCSV_KERNEL is set to a narrower one (scalar, sse2 or avx2)
+//
+// The phases are
+//   load   read the files into memory
+//   parse  split and index the rows (InputFile::read_buffer)
+//   align  align the records (Aligner::align_rows)
+//   write  format the csv output (CsvSink, to a stream that only counts)
+//
+// For each phase the time, throughput (MB/s and records/s of the data the
+//   phase handles) and peak resident memory are reported.  On Linux the
+//   peak is reset before each phase, so it is the peak during that phase
+//   (which includes memory still held from earlier phases and runs);
+//   elsewhere it is the peak of the process so far.
+//
+// Use gen_chromatof to make files of any size, e.g.
+//     gen_chromatof -f 20 -c 5000 -p 4 -s 6 -o /tmp/synth
+//     bench_aligncsv -d 0.01 /tmp/synth*.csv
+//
+// Compile: g++ -O2 -I../src -o bench_aligncsv bench_aligncsv.cc
+//            ../src/libaligncsv.cc  (all on one line)
+//-
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <iterator>
+
+#include "libaligncsv.h"
+
+// Output stream buffer that counts characters and throws them away
+
+class CountingBuf : public std::streambuf {
+public:
+    CountingBuf () : count(0) {setp (buffer, buffer + sizeof buffer);}
+    size_t written () {return count + (pptr() - pbase());}
+protected:
+    int overflow (int c) {
+	count += pptr() - pbase() + (c != EOF);
+	setp (buffer, buffer + sizeof buffer);
+	return c == EOF ? 0 : c;
+    }
+private:
+    size_t count;
+    char buffer[65536];
+};
+
+static double now ()
+{
+    struct timeval tv;
+    gettimeofday (&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Reset the peak resident memory (Linux 4.0 or later)
+
+static bool reset_peak ()
+{
+    std::ofstream clear_refs ("/proc/self/clear_refs");
+    clear_refs << "5\n";
+    clear_refs.close();
+    return !clear_refs.fail();
+}
+
+// Peak resident memory in MB (VmHWM on Linux, else from getrusage)
+
+static double peak_mb ()
+{
+    std::ifstream status ("/proc/self/status");
+    std::string line;
+    while (std::getline (status, line)) {
+	if (!line.compare (0, 6, "VmHWM:")) {
+	    return atof (line.c_str() + 6) / 1024;
+	}
+    }
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0;   // bytes
+#else
+    return usage.ru_maxrss / 1024.0;      // kilobytes
+#endif
+}
+
+class Phase {
+public:
+    Phase (const char* phase_name)
+	: name(phase_name), seconds(-1), bytes(0), records(0), peak(0) {}
+    void done (double start, size_t nbytes, size_t nrecords) {
+	double elapsed = now() - start;
+	double phase_peak = peak_mb();
+	if (seconds < 0 || elapsed < seconds) {
+	    seconds = elapsed;
+	}
+	if (phase_peak > peak) {
+	    peak = phase_peak;
+	}
+	bytes = nbytes;
+	records = nrecords;
+    }
+    void report () const {
+	double rate = seconds > 0 ? 1 / seconds : 0;
+	printf ("%-6s %10.4f %10.1f %12.0f %10.1f\n", name, seconds,
+		bytes * rate / 1048576, records * rate, peak);
+    }
+    const char* name;
+    double seconds;
+    size_t bytes;
+    size_t records;
+    double peak;
+};
+
+int main (int argc, char** argv)
+{
+    aligncsv::AlignOptions options;
+    float adiff = 0.01;
+    int repeats = 3;
+    std::vector<std::string> filenames;
+
+    for (int iarg = 1; iarg < argc; iarg++)
+    {
+	if (!strcmp (argv[iarg], "-1")) {
+	    options.single_header = 1;
+	} else if (!strcmp (argv[iarg], "-m")) {
+	    options.LineTerminator = MICROSOFT_TERMINATOR;
+	} else if (!strcmp (argv[iarg], "-r")) {
+	    options.restricted = true;
+	} else if (!strcmp (argv[iarg], "-l")) {
+	    options.lazy = true;
+	} else if (!strcmp (argv[iarg], "-d") && iarg + 1 < argc) {
+	    adiff = atof (argv[++iarg]);
+	} else if (!strcmp (argv[iarg], "-n") && iarg + 1 < argc) {
+	    repeats = atoi (argv[++iarg]);
+	} else if (argv[iarg][0] == '-') {
+	    std::cerr << "Usage: bench_aligncsv [-d <diff>] [-1] [-m] [-r] "
+		"[-l] [-n <repeats>] <filename>+\n";
+	    return -1;
+	} else {
+	    filenames.push_back (argv[iarg]);
+	}
+    }
+    if (filenames.empty() || repeats < 1) {
+	std::cerr << "Usage: bench_aligncsv [-d <diff>] [-1] [-m] [-r] "
+	    "[-l] [-n <repeats>] <filename>+\n";
+	return -1;
+    }
+
+    bool phase_peaks = reset_peak();
+    Phase load ("load");
+    Phase parse ("parse");
+    Phase align ("align");
+    Phase write ("write");
+    size_t nrows = 0;
+
+    for (int irepeat = 0; irepeat < repeats; irepeat++)
+    {
+	reset_peak();
+	double start = now();
+	std::vector<std::string> contents (filenames.size());
+	size_t total_bytes = 0;
+	for (int ifile = 0; ifile < filenames.size(); ifile++)
+	{
+	    std::ifstream infile (filenames[ifile].c_str());
+	    if (infile.fail()) {
+		std::cerr << "No Such File: " << filenames[ifile] << "\n";
+		return -1;
+	    }
+	    contents[ifile].assign (std::istreambuf_iterator<char>(infile),
+				    std::istreambuf_iterator<char>());
+	    total_bytes += contents[ifile].size();
+	}
+	load.done (start, total_bytes, 0);
+
+	reset_peak();
+	start = now();
+	aligncsv::Aligner aligner (options);
+	size_t total_records = 0;
+	for (int ifile = 0; ifile < filenames.size(); ifile++)
+	{
+	    if (aligner.add_buffer (filenames[ifile], contents[ifile].data(),
+				    contents[ifile].size())) {
+		std::cerr << aligner.error();
+		return -1;
+	    }
+	    const aligncsv::RecordMap& records = aligner.file(ifile).records;
+	    for (aligncsv::RecordMap::const_iterator it = records.begin();
+		 it != records.end(); ++it)
+	    {
+		total_records += it->second.size();
+	    }
+	}
+	parse.done (start, total_bytes, total_records);
+	load.records = total_records;
+
+	reset_peak();
+	start = now();
+	std::vector<aligncsv::AlignedRow> rows;
+	aligner.align_rows (adiff, rows);
+	align.done (start, total_bytes, total_records);
+	nrows = rows.size();
+
+	reset_peak();
+	start = now();
+	CountingBuf counter;
+	std::ostream out (&counter);
+	std::vector<std::string> lines;
+	aligner.header_lines (lines);
+	for (int iline = 0; iline < lines.size(); iline++)
+	{
+	    out << lines[iline];
+	}
+	aligncsv::CsvSink sink (out, options.LineTerminator);
+	for (int irow = 0; irow < rows.size(); irow++)
+	{
+	    sink.row (aligner, rows[irow]);
+	}
+	out.flush();
+	write.done (start, counter.written(), rows.size());
+    }
+
+    printf ("%d files, %.1f MB, %lu records, %lu rows aligned "
+	    "(best of %d, %s tokenizer)\n", (int) filenames.size(),
+	    load.bytes / 1048576.0, (unsigned long) load.records,
+	    (unsigned long) nrows, repeats,
+	    aligncsv::cpu_kernel_name (aligncsv::cpu_kernel()));
+    printf ("%-6s %10s %10s %12s %10s\n", "phase", "seconds", "MB/s",
+	    "records/s", phase_peaks ? "peak MB" : "max MB");
+    load.report();
+    parse.report();
+    align.report();
+    write.report();
+    return 0;
+}
@@ -0,0 +1,187 @@
+#!/bin/sh
+# Filename: compare_versions.sh
+# Purpose: build every version of aligncsv, run them all on the same inputs,
+#   and compare their run time, peak memory and output
+# Usage: compare_versions.sh [-r <reference>] [-w <workdir>] [<option>]*
+#        -r <reference> the variant the others' output is compared with
+#           (v1, v2, v3, v4, v4-lazy or rcpp; default v4)
+#        -w <workdir> where programs, inputs and outputs go
+#           (default /tmp/aligncsv_versions, inputs are kept for later runs)
+#        other options are passed to every variant, so should be ones all
+#           versions have, in the order the old versions require:
+#           [-1] [-d <diff>] [-m]
+#
+# Variants:
+#   v1, v2, v3  the historical programs, built unchanged
+#   v4          the current aligncsv
+#   v4-lazy     the current aligncsv with -l
+#   rcpp        align_frames() from aligncsv_cpp.cpp, through Rscript (only
+#               when R and Rcpp are installed).  It returns a data frame,
+#               not csv text, so only its number of rows is compared, and
+#               its time and memory include starting R.
+#
+# Input sets:
+#   data   the sample files in data/
+#   small  4 generated files (gen_chromatof -f 4 -c 500 -p 3 -s 6)
+#   large  10 generated files (gen_chromatof -f 10 -c 2000 -p 4 -s 6)
+#
+# For each set and variant, one line gives the time, peak resident memory,
+#   number of output rows, and "same" or "DIFF" against the reference.
+#   The exit status is 1 if any output differs.
+
+BENCHDIR=$(cd "$(dirname "$0")" && pwd)
+SRCDIR=$(cd "$BENCHDIR/../src" && pwd)
+DATADIR=$(cd "$BENCHDIR/../data" && pwd)
+WORKDIR=/tmp/aligncsv_versions
+REFERENCE=v4
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+	-r) REFERENCE=$2; shift 2 ;;
+	-w) WORKDIR=$2; shift 2 ;;
+	*) break ;;
+    esac
+done
+OPTIONS="$*"
+
+# The -d value, for align_frames
+
+DIFF=0.01
+set -- $OPTIONS
+while [ $# -gt 0 ]; do
+    if [ "$1" = "-d" ]; then
+	DIFF=$2
+    fi
+    shift
+done
+
+# Build
+
+BIN=$WORKDIR/bin
+mkdir -p "$BIN" || exit 2
+echo "Building in $BIN"
+$CXX $CXXFLAGS -w -x c++ -o "$BIN/v1" "$SRCDIR/aligncsv_v1.cp" || exit 2
+$CXX $CXXFLAGS -w -o "$BIN/v2" "$SRCDIR/aligncsv_v2.cc" || exit 2
+$CXX $CXXFLAGS -w -o "$BIN/v3" "$SRCDIR/aligncsv_v3.cc" || exit 2
+$CXX $CXXFLAGS -o "$BIN/v4" "$SRCDIR/aligncsv_v4.cc" \
+    "$SRCDIR/aligncsv_serve.cc" "$SRCDIR/aligncsv_manifest.cc" \
+    "$SRCDIR/libaligncsv.cc" || exit 2
+$CXX $CXXFLAGS -o "$BIN/runstat" "$BENCHDIR/runstat.cc" || exit 2
+$CXX $CXXFLAGS -o "$BIN/gen_chromatof" "$BENCHDIR/gen_chromatof.cc" || exit 2
+
+VARIANTS="v1 v2 v3 v4 v4-lazy"
+
+# The R interface is compiled by Rcpp::sourceCpp, from a copy of
+#   aligncsv_cpp.cpp with the library appended (sourceCpp compiles one file)
+
+if Rscript -e 'quit(status = !requireNamespace("Rcpp", quietly = TRUE))' \
+    > /dev/null 2>&1; then
+    mkdir -p "$BIN/rcpp"
+    cat "$SRCDIR/aligncsv_cpp.cpp" > "$BIN/rcpp/aligncsv_rcpp.cpp"
+    echo "#include \"$SRCDIR/libaligncsv.cc\"" >> "$BIN/rcpp/aligncsv_rcpp.cpp"
+    cat > "$BIN/rcpp/align.R" <<'EOF'
+args <- commandArgs(trailingOnly = TRUE)
+Sys.setenv(PKG_CPPFLAGS = paste0("-I", args[1]))
+Rcpp::sourceCpp(args[2], cacheDir = args[3])
+files <- args[-(1:4)]
+inputs <- lapply(files, function(f) readBin(f, "raw", file.size(f)))
+frame <- align_frames(inputs, diff = as.numeric(args[4]),
+                      lazy_columns = FALSE)
+cat(nrow(frame), "\n")
+EOF
+    echo "Compiling the R interface"
+    Rscript "$BIN/rcpp/align.R" "$SRCDIR" "$BIN/rcpp/aligncsv_rcpp.cpp" \
+	"$BIN/rcpp/cache" "$DIFF" "$DATADIR/lowest3.csv" > /dev/null || exit 2
+    VARIANTS="$VARIANTS rcpp"
+else
+    echo "R with Rcpp not found, skipping the rcpp variant"
+fi
+
+case " $VARIANTS " in
+    *" $REFERENCE "*) ;;
+    *) echo "Unknown reference $REFERENCE (variants: $VARIANTS)"; exit 2 ;;
+esac
+
+# Inputs
+
+INPUTS=$WORKDIR/inputs
+mkdir -p "$INPUTS/small" "$INPUTS/large"
+[ -f "$INPUTS/small/f1.csv" ] ||
+    "$BIN/gen_chromatof" -f 4 -c 500 -p 3 -s 6 -o "$INPUTS/small/f" > /dev/null
+[ -f "$INPUTS/large/f1.csv" ] ||
+    "$BIN/gen_chromatof" -f 10 -c 2000 -p 4 -s 6 -o "$INPUTS/large/f" \
+	> /dev/null
+
+set_files () {
+    case "$1" in
+	data) echo "$DATADIR/All_male.csv $DATADIR/All_female.csv" \
+	    "$DATADIR/lowest3.csv $DATADIR/lowest4.csv" ;;
+	*) ls "$INPUTS/$1"/f*.csv ;;
+    esac
+}
+
+# Run one variant on one set in its own directory (the old versions always
+#   write aligncsv.csv), leaving the runstat line in stat and the number
+#   of output rows in rows
+
+run_variant () {
+    variant=$1
+    dir=$2
+    shift 2
+    rm -rf "$dir"
+    mkdir -p "$dir"
+    (
+	cd "$dir" || exit 2
+	case $variant in
+	    v4-lazy) "$BIN/runstat" "$BIN/v4" -l $OPTIONS "$@" ;;
+	    rcpp) "$BIN/runstat" Rscript "$BIN/rcpp/align.R" "$SRCDIR" \
+		"$BIN/rcpp/aligncsv_rcpp.cpp" "$BIN/rcpp/cache" "$DIFF" "$@" \
+		> rows ;;
+	    *) "$BIN/runstat" "$BIN/$variant" $OPTIONS "$@" ;;
+	esac > log 2> err
+	grep '^runstat ' err | tail -1 > stat
+	if [ -f aligncsv.csv ]; then
+	    grep -c -v -e '^,' -e '^Peak' aligncsv.csv > rows
+	fi
+    )
+}
+
+status=0
+printf "\n%-6s %-8s %9s %9s %7s  %s\n" set variant seconds "peak MB" rows \
+    "output vs $REFERENCE"
+for set in data small large; do
+    files=`set_files $set`
+    run_variant $REFERENCE "$WORKDIR/out/$set/$REFERENCE" $files
+    for variant in $VARIANTS; do
+	dir=$WORKDIR/out/$set/$variant
+	refdir=$WORKDIR/out/$set/$REFERENCE
+	if [ $variant != $REFERENCE ]; then
+	    run_variant $variant "$dir" $files
+	fi
+	read tag seconds peak_kb exit_status < "$dir/stat"
+	rows=`cat "$dir/rows" 2>/dev/null | tr -d ' '`
+	if [ "$exit_status" != 0 ]; then
+	    result="FAILED (exit $exit_status, see $dir/err)"
+	    status=1
+	elif [ $variant = $REFERENCE ]; then
+	    result=reference
+	elif [ $variant = rcpp ] || [ $REFERENCE = rcpp ]; then
+	    if [ "$rows" = "`cat "$refdir/rows" | tr -d ' '`" ]; then
+		result="same rows"
+	    else
+		result="DIFF rows"
+		status=1
+	    fi
+	elif cmp -s "$dir/aligncsv.csv" "$refdir/aligncsv.csv"; then
+	    result=same
+	else
+	    result=DIFF
+	    status=1
+	fi
+	printf "%-6s %-8s %9s %9.1f %7s  %s\n" $set $variant $seconds \
+	    `echo $peak_kb | awk '{print $1 / 1024}'` "$rows" "$result"
+    done
+done
+exit $status
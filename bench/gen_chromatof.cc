@@ -0,0 +1,242 @@
+// Filename: gen_chromatof.cc
+// Purpose: generate synthetic Chromatof csv files for benchmarking aligncsv
+// Usage: gen_chromatof [-f <files>] [-c <chemicals>] [-p <peaks>]
+//                      [-s <samples>] [-j <jitter>] [-m <missing>]
+//                      [-x <seed>] [-o <prefix>]
+//        -f <files> number of files to write (default 4)
+//        -c <chemicals> number of distinct chemicals (default 500)
+//        -p <peaks> peaks per chemical, i.e. rows with the same name at
+//           different times (default 3)
+//        -s <samples> samples per file, each with its own group of data
+//           columns (default 6)
+//        -j <jitter> largest fraction by which a peak's 1st dimension time
+//           varies from file to file (default 0.005)
+//        -m <missing> fraction of peaks missing from each file (default 0.1)
+//        -x <seed> random seed, the same seed giving the same files
+//           (default 1)
+//        -o <prefix> files are written as <prefix>1.csv, <prefix>2.csv ...
+//           (default synth)
+//
+// The files look like the Chromatof exports in data/: two header lines,
+//   the first naming each sample over its group of columns, then rows of
+//   "Peak","Class", 1st and 2nd dimension times, Area and S/N for each
+//   sample, all quoted, and each line ends with the trailing comma and
+//   \r\n that Excel on Windows writes.  Some chemical names contain
+//   commas (e.g. "1,3,5-Analyte 12").  1st dimension times are multiples
+//   of the 5 s modulation period, and rows are in time order.
+//
+// Compile: g++ -O2 -o gen_chromatof gen_chromatof.cc
+//-
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#define MODULATION 5  // seconds, 1st dimension times are multiples of this
+#define LINE_END ",\r\n"   // as Excel writes on Windows
+
+// Small portable random number generator (xorshift), so that a seed
+//   gives the same files on any system
+
+class Random {
+public:
+    Random (unsigned long seed) {state = seed * 2654435761UL + 1;}
+    double uniform () {      // 0 <= u < 1
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	state &= 0xffffffffUL;
+	return state / 4294967296.0;
+    }
+    double between (double low, double high)
+	{return low + (high - low) * uniform();}
+private:
+    unsigned long state;
+};
+
+// One peak as it appears in a file
+
+class Peak {
+public:
+    int chemical;
+    int time1;
+    double time2;
+    static bool earlier (const Peak& p1, const Peak& p2)
+	{return p1.time1 < p2.time1 ||
+	     (p1.time1 == p2.time1 && p1.chemical < p2.chemical);}
+};
+
+static std::string chemical_name (int ichem)
+{
+    std::ostringstream name;
+    switch (ichem % 4) {
+    case 0:
+	name << "Analyte " << ichem;
+	break;
+    case 1:
+	name << "1,3,5-Analyte " << ichem;  // embedded commas
+	break;
+    case 2:
+	name << "Methyl-" << ichem << "-propanal";
+	break;
+    default:
+	name << "Cyclohexane, " << ichem << "-methyl-";
+    }
+    return name.str();
+}
+
+static bool number_arg (int argc, char** argv, int& iarg, double& value)
+{
+    if (iarg + 1 >= argc) {
+	std::cerr << argv[iarg] << " requires a value\n";
+	return false;
+    }
+    char* ppend;
+    value = strtod (argv[iarg+1], &ppend);
+    if (*ppend != 0 || ppend == argv[iarg+1] || value < 0) {
+	std::cerr << argv[iarg] << " value must be a number >= 0\n";
+	return false;
+    }
+    iarg += 2;
+    return true;
+}
+
+int main (int argc, char** argv)
+{
+    double nfiles = 4;
+    double nchemicals = 500;
+    double npeaks = 3;
+    double nsamples = 6;
+    double jitter = 0.005;
+    double missing = 0.1;
+    double seed = 1;
+    std::string prefix = "synth";
+
+    int iarg = 1;
+    while (iarg < argc) {
+	bool ok = true;
+	if (!strcmp (argv[iarg], "-f")) {
+	    ok = number_arg (argc, argv, iarg, nfiles);
+	} else if (!strcmp (argv[iarg], "-c")) {
+	    ok = number_arg (argc, argv, iarg, nchemicals);
+	} else if (!strcmp (argv[iarg], "-p")) {
+	    ok = number_arg (argc, argv, iarg, npeaks);
+	} else if (!strcmp (argv[iarg], "-s")) {
+	    ok = number_arg (argc, argv, iarg, nsamples);
+	} else if (!strcmp (argv[iarg], "-j")) {
+	    ok = number_arg (argc, argv, iarg, jitter);
+	} else if (!strcmp (argv[iarg], "-m")) {
+	    ok = number_arg (argc, argv, iarg, missing);
+	} else if (!strcmp (argv[iarg], "-x")) {
+	    ok = number_arg (argc, argv, iarg, seed);
+	} else if (!strcmp (argv[iarg], "-o") && iarg + 1 < argc) {
+	    prefix = argv[iarg+1];
+	    iarg += 2;
+	} else {
+	    std::cerr << "Usage: gen_chromatof [-f <files>] [-c <chemicals>] "
+		"[-p <peaks>] [-s <samples>]\n"
+		"                     [-j <jitter>] [-m <missing>] [-x <seed>] "
+		"[-o <prefix>]\n";
+	    return -1;
+	}
+	if (!ok) {
+	    return -1;
+	}
+    }
+    if (nfiles < 1 || nsamples < 1 || npeaks < 1) {
+	std::cerr << "files, peaks and samples must be at least 1\n";
+	return -1;
+    }
+
+// The true peaks: each chemical's peaks at distinct times, with a 2nd
+//   dimension time that is nearly the same for all its peaks
+
+    Random random ((unsigned long) seed);
+    int ntrue = (int) nchemicals * (int) npeaks;
+    std::vector<Peak> peaks (ntrue);
+    for (int ichem = 0; ichem < (int) nchemicals; ichem++)
+    {
+	double time2 = random.between (0.5, 4);
+	for (int ipeak = 0; ipeak < (int) npeaks; ipeak++)
+	{
+	    Peak& peak = peaks[ichem * (int) npeaks + ipeak];
+	    peak.chemical = ichem;
+	    peak.time1 = MODULATION * (int) random.between (20, 600);
+	    peak.time2 = time2 + random.between (-0.2, 0.2);
+	}
+    }
+    std::vector<std::string> names ((int) nchemicals);
+    for (int ichem = 0; ichem < (int) nchemicals; ichem++)
+    {
+	names[ichem] = chemical_name (ichem);
+    }
+
+    for (int ifile = 1; ifile <= (int) nfiles; ifile++)
+    {
+	std::ostringstream filename;
+	filename << prefix << ifile << ".csv";
+	std::ofstream out (filename.str().c_str());
+	if (out.fail()) {
+	    std::cerr << "Unable to open output file " << filename.str()
+		      << "\n";
+	    return -10;
+	}
+
+// Headers, each sample named over its five columns
+
+	for (int isample = 1; isample <= (int) nsamples; isample++)
+	{
+	    out << ",\"Sample " << ifile << "-" << isample << ":1\",,,,";
+	}
+	out << LINE_END << "Peak";
+	for (int isample = 1; isample <= (int) nsamples; isample++)
+	{
+	    out << ",Class,1st Dimension Time (s),2nd Dimension Time (s),"
+		"Area,S/N";
+	}
+	out << LINE_END;
+
+// This file's peaks, each time varied by up to the jitter fraction
+
+	std::vector<Peak> file_peaks;
+	for (int ipeak = 0; ipeak < ntrue; ipeak++)
+	{
+	    if (random.uniform() < missing) {
+		continue;
+	    }
+	    Peak peak = peaks[ipeak];
+	    double time1 = peak.time1 *
+		(1 + random.between (-jitter, jitter));
+	    peak.time1 = MODULATION * (int) floor (time1 / MODULATION + 0.5);
+	    file_peaks.push_back (peak);
+	}
+	std::sort (file_peaks.begin(), file_peaks.end(), Peak::earlier);
+
+	char number[64];
+	for (int ipeak = 0; ipeak < file_peaks.size(); ipeak++)
+	{
+	    const Peak& peak = file_peaks[ipeak];
+	    out << "\"" << names[peak.chemical] << "\"";
+	    for (int isample = 0; isample < (int) nsamples; isample++)
+	    {
+		double area = exp (random.between (12, 19));
+		double sn = area / random.between (500, 5000);
+		sprintf (number, "\"%d\",\"%.3f\",\"%.2f\",\"%.3f\"",
+			 peak.time1, peak.time2 + random.between (-0.05, 0.05),
+			 area, sn);
+		out << ",\"Class1\"," << number;
+	    }
+	    out << LINE_END;
+	}
+	std::cout << filename.str() << ": " << file_peaks.size()
+		  << " rows\n";
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Filename: pgo_train.sh
+# Purpose: run an instrumented aligncsv on a representative workload, for
+#   the profile-guided release build (make release)
+# Usage: pgo_train.sh <aligncsv> <gen_chromatof> <workdir>
+#
+# The workload is generated files of a few shapes (few and many peaks per
+#   chemical, many files, missing peaks), aligned with the options that
+#   take different paths through the reading and alignment code: several
+#   <diff> values at once, integer <diff>, -d2, --sequential-dp, --by-time,
+#   -l, -r, -1 -m, the record and chemical filters, and --manifest.  Each run
+#   is kept short, as only the relative counts matter to the compiler.
+#   Runs use one thread, so the counts aren't lost to races between
+#   threads.
+
+ALIGNCSV=$1
+GEN=$2
+WORKDIR=$3
+if [ $# -ne 3 ]; then
+    echo "Usage: pgo_train.sh <aligncsv> <gen_chromatof> <workdir>"
+    exit 2
+fi
+OMP_NUM_THREADS=1
+export OMP_NUM_THREADS
+
+rm -rf "$WORKDIR"
+mkdir -p "$WORKDIR/out" || exit 1
+
+# files chemicals peaks samples missing
+for shape in "4 2000 3 6 0.1" "10 1000 8 4 0.3" "20 300 2 10 0.05"; do
+    set -- $shape
+    "$GEN" -f $1 -c $2 -p $3 -s $4 -m $5 -o "$WORKDIR/f$1_c$2_p$3_" \
+	> /dev/null || exit 1
+done
+
+run=0
+align () {
+    run=$((run + 1))
+    "$ALIGNCSV" -o "$WORKDIR/out/run$run.csv" "$@" > /dev/null || exit 1
+}
+
+for set in f4_c2000_p3_ f10_c1000_p8_ f20_c300_p2_; do
+    files=`ls "$WORKDIR/$set"*.csv`
+    align -d 0.005,0.01,0.02 $files
+    align -d 5 $files
+    align -l $files
+    align -r $files
+    align -1 -m $files
+    align -d2 0.05 $files
+    align --sequential-dp $files
+    align --by-time $files
+    align -l --min-sn 100 --time1-range 200:2000 $files
+done
+
+# chemical lists and a manifest of jobs over subsets of the files
+
+awk -F'"' 'NR > 2 && NR <= 200 {print $2}' "$WORKDIR/f4_c2000_p3_1.csv" \
+    > "$WORKDIR/chemicals.txt"
+align --chemicals "$WORKDIR/chemicals.txt" "$WORKDIR"/f4_c2000_p3_*.csv
+align -l --exclude-chemicals "$WORKDIR/chemicals.txt" \
+    "$WORKDIR"/f4_c2000_p3_*.csv
+cd "$WORKDIR" || exit 1
+cat > manifest.txt <<EOF
+out/job1.csv -d 0.01 f10_c1000_p8_1.csv f10_c1000_p8_2.csv f10_c1000_p8_3.csv
+out/job2.csv -r f10_c1000_p8_4.csv f10_c1000_p8_5.csv f10_c1000_p8_6.csv
+out/job3.csv -d 2 -m f10_c1000_p8_1.csv f10_c1000_p8_6.csv
+EOF
+"$ALIGNCSV" --manifest manifest.txt > /dev/null || exit 1
+echo "Trained on $((run + 1)) runs in $WORKDIR"
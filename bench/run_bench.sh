@@ -0,0 +1,36 @@
+#!/bin/sh
+# Filename: run_bench.sh
+# Purpose: build the benchmark and run it on synthetic files of several sizes
+# Usage: run_bench.sh [<workdir>] [bench_aligncsv options]
+#        files are generated in workdir (default /tmp/aligncsv_bench)
+#        and kept for later runs.  If BENCH and GEN name bench_aligncsv
+#        and gen_chromatof programs already built (as make bench does),
+#        those are used, else both are built in workdir.
+
+BENCHDIR=`dirname "$0"`
+WORKDIR=${1:-/tmp/aligncsv_bench}
+[ $# -gt 0 ] && shift
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+
+mkdir -p "$WORKDIR" || exit 1
+if [ -z "$BENCH" ] || [ -z "$GEN" ]; then
+    GEN="$WORKDIR/gen_chromatof"
+    BENCH="$WORKDIR/bench_aligncsv"
+    $CXX $CXXFLAGS -o "$GEN" "$BENCHDIR/gen_chromatof.cc" || exit 1
+    $CXX $CXXFLAGS -I"$BENCHDIR/../src" -o "$BENCH" \
+	"$BENCHDIR/bench_aligncsv.cc" "$BENCHDIR/../src/libaligncsv.cc" || exit 1
+fi
+
+# files chemicals peaks samples
+for size in "4 500 3 6" "10 2000 4 6" "20 5000 4 10"; do
+    set -- $size "$@"
+    name="$WORKDIR/f$1_c$2_p$3_s$4_"
+    if [ ! -f "${name}1.csv" ]; then
+	"$GEN" -f $1 -c $2 -p $3 -s $4 -o "$name" > /dev/null
+    fi
+    echo
+    echo "$1 files, $2 chemicals, $3 peaks per chemical, $4 samples per file"
+    shift 4
+    "$BENCH" "$@" "$name"*.csv
+done
@@ -0,0 +1,66 @@
+// Filename: runstat.cc
+// Purpose: run a command and report its wall time and peak memory
+// Usage: runstat <command> [<arg>]+
+//
+// After the command finishes, one line is written to stderr:
+//
+//     runstat <seconds> <peak resident kB> <exit status>
+//
+// The command's own output is not changed.  Used by compare_versions.sh,
+//   as /usr/bin/time is not always installed (and its output differs
+//   between systems).
+//
+// Compile: g++ -O2 -o runstat runstat.cc
+//-
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+int main (int argc, char** argv)
+{
+    if (argc < 2) {
+	fprintf (stderr, "Usage: runstat <command> [<arg>]+\n");
+	return -1;
+    }
+    struct timeval start;
+    gettimeofday (&start, 0);
+    pid_t pid = fork();
+    if (pid < 0) {
+	fprintf (stderr, "runstat: fork failed: %s\n", strerror (errno));
+	return -1;
+    }
+    if (pid == 0) {
+	execvp (argv[1], argv + 1);
+	fprintf (stderr, "runstat: unable to run %s: %s\n", argv[1],
+		 strerror (errno));
+	_exit (127);
+    }
+
+    int status;
+    struct rusage usage;
+    while (wait4 (pid, &status, 0, &usage) < 0) {
+	if (errno != EINTR) {
+	    fprintf (stderr, "runstat: wait failed: %s\n", strerror (errno));
+	    return -1;
+	}
+    }
+    struct timeval end;
+    gettimeofday (&end, 0);
+    double seconds = (end.tv_sec - start.tv_sec) +
+	(end.tv_usec - start.tv_usec) * 1e-6;
+#ifdef __APPLE__
+    long peak_kb = usage.ru_maxrss / 1024;  // bytes
+#else
+    long peak_kb = usage.ru_maxrss;         // kilobytes
+#endif
+    int exit_status = WIFEXITED (status) ? WEXITSTATUS (status) :
+	128 + WTERMSIG (status);
+    fprintf (stderr, "runstat %.4f %ld %d\n", seconds, peak_kb, exit_status);
+    return exit_status;
+}
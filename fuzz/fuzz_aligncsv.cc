@@ -0,0 +1,1540 @@
+// Filename: fuzz_aligncsv.cc
+// Purpose: differential fuzzer checking each way the library reads and
+//   aligns files against a reference copy of the aligncsv_v3 algorithm
+// Usage: fuzz_aligncsv [-n <cases>] [-x <seed>] [-w <dir>] [<case file>]*
+//        -n <cases> number of generated cases to check (default 10000)
+//        -x <seed> seed of the first case, each later case using the next
+//           seed (default 1)
+//        -w <dir> also write each generated case to <dir>, e.g. to start
+//           a libFuzzer corpus
+//        if case files are given (e.g. a libFuzzer crash), they are checked
+//           instead of generated cases
+//
+// A case is one alignment.  Byte 0 holds option bits (1 for -1, 2 for -m,
+//   4 for -r), byte 1 chooses <diff> from DIFFS (byte % 8) and the -d2
+//   <diff> from DIFFS (byte / 8 % 8), and the rest is the input files,
+//   separated by form feeds.
+//
+// Each case is aligned by the reference, which reads and aligns just as
+//   aligncsv_v3.cc did (getline and the character loop for reading, whole
+//   records sorted and popped for alignment), and then by each of the
+//   library's paths (VARIANTS below).  Every path must give the reference's
+//   read status, and if the files were read, the reference's output byte
+//   for byte.  Aligning again with the same Aligner must give the same
+//   output, and get_field must agree with get_fields.  On any difference
+//   the case is described and the program aborts, so that libFuzzer (and
+//   the sanitizers) treat it as a crash.
+//
+// Options the reference doesn't have (e.g. -d2, --by-time) are checked
+//   instead against simple versions written here (SELF_CHECKS below),
+//   which look through every record left, or sort again on every pass,
+//   rather than using the library's indexes and sweeps.  Their rows must
+//   be the library's, in any order.
+//
+// Generated cases look like Chromatof exports with the awkward parts made
+//   common: quotes and commas within names and fields, doubled quotes,
+//   \r\n and \r\r\n endings, trailing commas, tied times, duplicate rows,
+//   short and long rows, stray characters, and now and then a bad time.
+//   The field after the time is usually a 2nd dimension time.
+//
+// New fast paths (e.g. a vectorized tokenizer) should be added to VARIANTS,
+//   so that they are checked against the reference as well.  Each of the
+//   tokenizer's cpu kernels is used by some variants (those the processor
+//   doesn't support are skipped).
+//
+// Compile (standalone, with sanitizers):
+//   g++ -O1 -g -fsanitize=address,undefined -I../src -o fuzz_aligncsv
+//     fuzz_aligncsv.cc ../src/libaligncsv.cc  (all on one line)
+// Compile (libFuzzer, which provides main):
+//   clang++ -O1 -g -DLIBFUZZER -fsanitize=fuzzer,address,undefined -I../src
+//     -o fuzz_aligncsv_lf fuzz_aligncsv.cc ../src/libaligncsv.cc  (one line)
+//   and run with a corpus of generated cases:
+//     mkdir corpus; fuzz_aligncsv -n 500 -w corpus; fuzz_aligncsv_lf corpus
+//-
+
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+#include "libaligncsv.h"
+
+static const float DIFFS[] = {0, 0.001, 0.01, 0.05, 0.5, 1, 5, 60};
+#define NDIFFS (int) (sizeof DIFFS / sizeof DIFFS[0])
+#define MAX_FILES 8
+#define FILE_SEPARATOR '\f'
+#define HANG_SECONDS 10   // standalone: a case taking longer is a failure
+
+// One alignment to check
+
+class Case {
+public:
+    Case () : single_header(0), microsoft(false), restricted(false),
+	      adiff(0.01), adiff2(0.01) {}
+    int single_header;
+    bool microsoft;
+    bool restricted;
+    float adiff;
+    float adiff2;     // for the self checks with -d2
+    std::vector<std::string> files;
+    bool decode (const unsigned char* data, size_t size);
+    std::string encode () const;
+    void describe (std::ostream& out) const;
+};
+
+bool Case::decode (const unsigned char* data, size_t size)
+{
+    if (size < 2) {
+	return false;
+    }
+    single_header = data[0] & 1;
+    microsoft = (data[0] & 2) != 0;
+    restricted = (data[0] & 4) != 0;
+    adiff = DIFFS[data[1] % NDIFFS];
+    adiff2 = DIFFS[data[1] / NDIFFS % NDIFFS];
+    files.clear();
+    std::string text ((const char*) data + 2, size - 2);
+    std::string::size_type start = 0;
+    while (files.size() < MAX_FILES) {
+	std::string::size_type end = text.find (FILE_SEPARATOR, start);
+	if (end == std::string::npos) {
+	    files.push_back (text.substr (start));
+	    break;
+	}
+	files.push_back (text.substr (start, end - start));
+	start = end + 1;
+    }
+    return true;
+}
+
+std::string Case::encode () const
+{
+    std::string data;
+    data += (char) (single_header | (microsoft ? 2 : 0) |
+		    (restricted ? 4 : 0));
+    int idiff = 0;
+    while (idiff < NDIFFS - 1 && DIFFS[idiff] != adiff) {
+	idiff++;
+    }
+    int idiff2 = 0;
+    while (idiff2 < NDIFFS - 1 && DIFFS[idiff2] != adiff2) {
+	idiff2++;
+    }
+    data += (char) (idiff + idiff2 * NDIFFS);
+    for (int ifile = 0; ifile < files.size(); ifile++)
+    {
+	if (ifile > 0) {
+	    data += FILE_SEPARATOR;
+	}
+	data += files[ifile];
+    }
+    return data;
+}
+
+// Show a string with its control characters and quotes visible
+
+static std::string visible (const std::string& text)
+{
+    std::string shown;
+    for (int i = 0; i < text.length(); i++)
+    {
+	unsigned char c = text[i];
+	if (c == '\r') {
+	    shown += "\\r";
+	} else if (c == '\n') {
+	    shown += "\\n\n";
+	} else if (c < ' ' || c > '~') {
+	    char code[8];
+	    sprintf (code, "\\x%02x", c);
+	    shown += code;
+	} else {
+	    shown += c;
+	}
+    }
+    return shown;
+}
+
+void Case::describe (std::ostream& out) const
+{
+    out << "Options:" << (single_header ? " -1" : "") <<
+	(microsoft ? " -m" : "") << (restricted ? " -r" : "") <<
+	" -d " << adiff << " (-d2 " << adiff2 << ")\n";
+    for (int ifile = 0; ifile < files.size(); ifile++)
+    {
+	out << "--- file " << ifile + 1 << "\n" << visible (files[ifile])
+	    << "\n";
+    }
+}
+
+
+// The reference: reading and alignment as in aligncsv_v3.cc, with its
+//   globals made members, and only these changes:
+//   - each header is read into an empty string (v3 kept the previous
+//     file's last line if a file was empty)
+//   - a row with no time field is an error (v3 read past its fields)
+//   - the time buffer is terminated, and a time must be greater than zero
+//     (not negative or nan), as in the library
+//   - an empty second header name is not indexed before its start
+//   - rows missing from any file are dropped before sorting with -r
+//   Output goes to a string rather than aligncsv.csv.
+
+namespace reference {
+
+class ChemRecord {
+public:
+    ChemRecord () : time1(0) {}       // v3's NA was a zeroed global
+    std::vector<std::string> fields;  // data fields following chemical
+    float time1;
+    static bool higher (const ChemRecord& c1, const ChemRecord& c2)
+	{return c1.time1 > c2.time1;}
+    int nfields () const {return fields.size();}
+};
+
+class OutputRecord {
+public:
+    OutputRecord (const std::string& inputline, float intime1)
+	{line=inputline; time1=intime1;}
+    std::string line;
+    float time1;
+    static bool lower (const OutputRecord& r1, const OutputRecord& r2)
+	{return r1.time1 < r2.time1;}
+};
+
+typedef STDPRE::unordered_map<std::string,std::vector<ChemRecord> > FileData;
+
+class Aligncsv {
+public:
+    Aligncsv (int single) : single_header(single), header2_required(false) {}
+    int read (const std::string& text);
+    void align (float adiff, bool restricted,
+		const std::string& LineTerminator, std::string& out);
+private:
+    int single_header;
+    bool header2_required;
+    std::set<std::string> Chemicals;
+    std::vector<std::string> Header;
+    std::vector<std::string> Header1;
+    std::vector<std::string> Header2;
+    std::vector<int> DataColumns;
+    std::vector<FileData> AllFileData;
+};
+
+// The header loop, returning the number of counted empty fields
+
+static int read_header (const std::string& aline,
+			std::vector<std::string>& header)
+{
+    std::string field;
+    std::string last_field = "";
+    std::stringstream sstream(aline);
+    int count_empties = 0;
+    bool last_field_empty = false;
+    bool last_empty_field_counted = false;
+    while(std::getline (sstream, field, ',') )
+    {
+	last_field_empty = false;
+	last_empty_field_counted = false;
+	if (field.empty())
+	{
+	    count_empties++;
+	    field = last_field;
+	    last_field_empty = true;
+	    last_empty_field_counted = true;
+	} else {
+	    bool empty_field = false;
+	    int flen = field.length();
+	    if (flen < 3) {
+		empty_field = true;
+		for (int fin = 0; fin < flen; fin++)
+		{
+		    if (!std::isspace(field[fin]))
+		    {
+			empty_field = false;
+		    }
+		}
+		if (empty_field)
+		{
+		    field = last_field;
+		    last_field_empty = true;
+		}
+	    }
+	}
+	header.push_back (field);
+    }
+    if (last_field_empty)
+    {
+	header.pop_back();
+    }
+    if (last_empty_field_counted)
+    {
+	count_empties--;
+    }
+    return count_empties;
+}
+
+int Aligncsv::read (const std::string& text)
+{
+    std::istringstream infile (text);
+    int ifile = AllFileData.size();
+    FileData FileData;
+    std::vector<std::string> header1;
+    std::vector<std::string> header2;
+    std::string aline;
+    int record_size = 0;
+    DataColumns.push_back(0);
+
+    getline (infile, aline);
+    header2_required = read_header (aline, header1) != 0;
+    if (header2_required)
+    {
+	aline.clear();
+	getline (infile, aline);
+	if (read_header (aline, header2)) {
+	    return -2;
+	}
+	if (header2.size() != header1.size()) {
+	    return -3;
+	}
+	record_size = header2.size();
+    }
+    if (header2_required)
+    {
+	std::string last_suffix = "";
+	for (int ich = 0; ich < record_size; ich++)
+	{
+	    bool quote_prefix = false;
+	    bool quote_suffix = false;
+	    std::string composite = header2[ich];
+	    if (!composite.empty() &&
+		'"' == composite[composite.length()-1]) {
+		composite.erase(composite.length()-1);
+		quote_prefix = true;
+	    }
+	    std::string suffix = header1[ich];
+	    if (suffix.length() > 0) {
+		last_suffix = suffix;
+	    } else {
+		if (last_suffix.length() > 0) {
+		    suffix = last_suffix;
+		} else {
+		    suffix = "";
+		}
+	    }
+	    if (suffix[0] == '"' ) {
+		if (single_header) {
+		    suffix.erase(0,1);
+		}
+		quote_suffix = true;
+	    }
+	    if (suffix.length() > 0) {
+		composite += HEADER_SEPARATOR;
+		composite += suffix;
+	    }
+	    if (quote_prefix && (composite.empty() ||
+				 composite[composite.length()-1] != '"')) {
+		composite += "\"";
+	    }
+	    if (quote_suffix && !quote_prefix) {
+		composite = "\"" + composite;
+	    }
+	    Header.push_back (composite);
+	    if (ifile==0 || ich > 0) {
+		Header1.push_back (suffix);
+		Header2.push_back (header2[ich]);
+	    }
+	    DataColumns[ifile]++;
+	}
+    }
+    DataColumns[ifile]--;  // Remove peak column
+
+    while (getline(infile, aline))
+    {
+	std::vector<std::string> Fields;
+	std::string chemicalName;
+	std::string::iterator it = aline.begin();
+	bool finis = false;
+	unsigned quotes = 0;
+	char prev = 0;
+	while ( !finis && it != aline.end() )
+	{
+	    switch (*it) {
+	    case '"':
+		++quotes;
+		break;
+	    case ',':
+		if (quotes == 0 || (prev == '"' && (quotes & 1) == 0)) {
+		    finis = true;
+		}
+		break;
+	    default:;
+	    }
+	    if (!finis) {
+		chemicalName += prev = *it;
+	    }
+	    it++;
+	}
+	Chemicals.insert (chemicalName);
+
+	std::string field;
+	while (1) {
+	    finis = false;
+	    quotes = 0;
+	    field = "";
+	    while ( !finis && it != aline.end() )
+	    {
+		bool cr = false;
+		switch (*it) {
+		case '"':
+		    ++quotes;
+		    break;
+		case ',':
+		    if (quotes == 0 || (prev == '"' && (quotes & 1)==0)) {
+			finis = true;
+		    }
+		    break;
+		case '\r':
+		    cr = true;
+		    break;
+		default:;
+		}
+		if (!finis && !cr) {
+		    field += prev = *it;
+		}
+		it++;
+	    }
+	    Fields.push_back(field);
+	    if (it == aline.end() ) {
+		break;
+	    }
+	}
+	if (Fields.size() < 2) {
+	    return -1;
+	}
+	ChemRecord chemrecord;
+	chemrecord.fields = Fields;
+	const int bufsiz = 128;
+	char pstring[bufsiz];
+	strncpy (pstring,Fields[1].c_str(),bufsiz);
+	pstring[bufsiz-1] = '\0';
+	char* ppstring;
+	if (pstring[0] == '"') {
+	    ppstring = &pstring[1];
+	} else {
+	    ppstring = &pstring[0];
+	}
+	char* ppend;
+	float stime = strtof (ppstring, &ppend);
+	if (!(stime > 0) || (*ppend != '\0' && *ppend != '"')) {
+	    return -1;
+	}
+	chemrecord.time1 = stime;
+	FileData[chemicalName].push_back(chemrecord);
+    }
+    AllFileData.push_back(FileData);
+    return 0;
+}
+
+void Aligncsv::align (float adiff, bool restricted,
+		      const std::string& LineTerminator, std::string& out)
+{
+    std::ostringstream outfile;
+    bool afraction = adiff < 1;
+    int ninfiles = AllFileData.size();
+    ChemRecord NA;
+    std::vector<OutputRecord> OutputLines;
+
+    if (single_header || !header2_required) {
+	for (int ifield = 0; ifield < Header1.size(); ifield++)
+	{
+	    if (ifield > 0) {
+		outfile << ",";
+	    }
+	    outfile << Header[ifield];
+	}
+	outfile << LineTerminator;
+    } else {
+	std::string lastfield = "";
+	for (int ifield = 0; ifield < Header1.size(); ifield++) {
+	    if (ifield > 0) {
+		outfile << ",";
+	    }
+	    if (Header1[ifield] != lastfield) {
+		outfile << Header1[ifield];
+	    }
+	    lastfield = Header1[ifield];
+	}
+	outfile << LineTerminator;
+	for (int ifield = 0; ifield < Header2.size(); ifield++) {
+	    if (ifield > 0) {
+		outfile << ",";
+	    }
+	    outfile << Header2[ifield];
+	}
+	outfile << LineTerminator;
+    }
+
+    for (std::set<std::string>::iterator
+	     it = Chemicals.begin(); it != Chemicals.end(); ++it)
+    {
+	std::string keychem = *it;
+	bool more_data_seen = true;
+	while (more_data_seen) {
+	    std::string outline = keychem;
+	    std::vector<ChemRecord> lowest_recs;
+	    float lowest_time1 = 0;
+	    float second_lowest_time1 = 0;
+
+	    int ifile;
+	    more_data_seen = false;
+	    for (ifile = 0; ifile < ninfiles; ifile++)
+	    {
+		if (AllFileData[ifile].count(keychem) &&
+		    AllFileData[ifile][keychem].size()) {
+		    std::sort (AllFileData[ifile][keychem].begin(),
+			       AllFileData[ifile][keychem].end(),
+			       ChemRecord::higher);
+		    ChemRecord lowest  = AllFileData[ifile][keychem].back();
+		    AllFileData[ifile][keychem].pop_back();
+		    if (lowest_time1 == 0 ||
+			lowest_time1 > lowest.time1) {
+			lowest_time1 = lowest.time1;
+		    }
+		    lowest_recs.push_back(lowest);
+		    if (AllFileData[ifile][keychem].begin() ==
+			AllFileData[ifile][keychem].end() ) {
+		    } else {
+			more_data_seen = true;
+			float test_lowest_time1 =
+			    AllFileData[ifile][keychem].back().time1;
+			if (second_lowest_time1 == 0 ||
+			    second_lowest_time1 > test_lowest_time1) {
+			    second_lowest_time1 = test_lowest_time1;
+			}
+		    }
+		} else {
+		    lowest_recs.push_back(NA);
+		}
+	    }
+
+	    for (ifile = 0; ifile < ninfiles; ifile++)
+	    {
+		ChemRecord test_record = lowest_recs[ifile];
+		float cutoff;
+		if (afraction) {
+		    cutoff = (1 + adiff) * lowest_time1;
+		} else {
+		    cutoff = lowest_time1 + adiff;
+		}
+		bool pushback = false;
+		if (test_record.nfields() != 0) {
+		    if (test_record.time1 > cutoff) {
+			pushback = true;
+		    } else if (test_record.time1 - lowest_time1 >
+			       std::abs(second_lowest_time1 - test_record.time1))
+		    {
+			pushback = true;
+		    }
+		    if (pushback) {
+			more_data_seen = true;
+			AllFileData[ifile][keychem].push_back(test_record);
+			lowest_recs[ifile] = NA;
+		    }
+		}
+	    }
+
+	    bool complete = true;
+	    for (ifile=0; ifile < ninfiles; ifile++)
+	    {
+		if (lowest_recs[ifile].nfields()) {
+		    std::vector<std::string>::iterator field =
+			lowest_recs[ifile].fields.begin();
+		    int column = 0;
+		    for (; field != lowest_recs[ifile].fields.end();field++)
+		    {
+			if (++column > DataColumns[ifile]) {
+			    break;
+			}
+			outline += ",";
+			outline += *field;
+		    }
+		} else {
+		    complete = false;
+		    int column = 0;
+		    while (++column <= DataColumns[ifile])
+		    {
+			outline += ",";
+		    }
+		}
+	    }
+	    outline += LineTerminator;
+	    if (complete || !restricted) {
+		OutputLines.push_back (OutputRecord(outline,lowest_time1));
+	    }
+	}
+    }
+
+    std::sort (OutputLines.begin(),OutputLines.end(),OutputRecord::lower);
+    std::vector<OutputRecord>::iterator it;
+    for (it = OutputLines.begin(); it != OutputLines.end(); it++)
+    {
+	outfile << it->line;
+    }
+    out = outfile.str();
+}
+
+} // namespace reference
+
+// Align a case with the reference, returning the read status
+
+static int reference_align (const Case& c, std::string& out)
+{
+    reference::Aligncsv aligncsv (c.single_header);
+    for (int ifile = 0; ifile < c.files.size(); ifile++)
+    {
+	if (int status = aligncsv.read (c.files[ifile])) {
+	    return status;
+	}
+    }
+    aligncsv.align (c.adiff, c.restricted, c.microsoft ?
+		    MICROSOFT_TERMINATOR : UNIX_TERMINATOR, out);
+    return 0;
+}
+
+
+// The library's paths
+
+class Variant {
+public:
+    const char* name;
+    bool lazy;        // -l, splitting fields as they are written
+    bool buffer;      // add_buffer, rather than add_stream
+    int kernel;       // cpu kernel, or -1 for the one chosen at startup
+};
+
+static const Variant VARIANTS[] = {
+    {"eager stream", false, false, -1},
+    {"eager buffer", false, true, -1},
+    {"lazy stream", true, false, -1},
+    {"lazy buffer", true, true, -1},
+    {"eager stream scalar", false, false, aligncsv::SCALAR_KERNEL},
+    {"lazy buffer scalar", true, true, aligncsv::SCALAR_KERNEL},
+    {"eager buffer sse2", false, true, aligncsv::SSE2_KERNEL},
+    {"lazy stream sse2", true, false, aligncsv::SSE2_KERNEL},
+    {"eager stream avx2", false, false, aligncsv::AVX2_KERNEL},
+    {"lazy buffer avx2", true, true, aligncsv::AVX2_KERNEL},
+    {"eager buffer avx512", false, true, aligncsv::AVX512_KERNEL},
+    {"lazy stream avx512", true, false, aligncsv::AVX512_KERNEL}};
+#define NVARIANTS (int) (sizeof VARIANTS / sizeof VARIANTS[0])
+
+static int variants_checked = 0;
+
+// What the case being checked is (standalone only), for reporting
+
+static std::string case_label;
+
+static void fail (const Case& c, const Variant& variant, const char* problem)
+{
+    std::cerr << "\n*** " << variant.name << ": " << problem << "\n";
+    if (!case_label.empty()) {
+	std::cerr << "Case: " << case_label << "\n";
+    }
+    c.describe (std::cerr);
+    abort();
+}
+
+static void compare (const Case& c, const Variant& variant,
+		     const std::string& expected, const std::string& got,
+		     const char* what)
+{
+    if (got == expected) {
+	return;
+    }
+    std::istringstream expected_lines (expected);
+    std::istringstream got_lines (got);
+    std::string expected_line;
+    std::string got_line;
+    int lineno = 0;
+    while (1) {
+	lineno++;
+	bool more_expected = (bool) getline (expected_lines, expected_line);
+	bool more_got = (bool) getline (got_lines, got_line);
+	if (!more_expected || !more_got || expected_line != got_line) {
+	    std::cerr << "\n*** " << variant.name << ": " << what
+		      << " differs at line " << lineno << "\nexpected: "
+		      << (more_expected ? visible (expected_line) : "(end)")
+		      << "\n     got: "
+		      << (more_got ? visible (got_line) : "(end)") << "\n";
+	    break;
+	}
+    }
+    fail (c, variant, "output differs");
+}
+
+// Check that get_field gives each of the fields get_fields does, and an
+//   empty field beyond them
+
+static void check_fields (const Case& c, const Variant& variant,
+			  const aligncsv::Aligner& aligner, float adiff)
+{
+    std::vector<aligncsv::AlignedRow> rows;
+    aligner.align_rows (adiff, rows);
+    std::vector<std::string> fields;
+    std::string field;
+    for (int irow = 0; irow < rows.size(); irow++)
+    {
+	for (int ifile = 0; ifile < rows[irow].records.size(); ifile++)
+	{
+	    const aligncsv::ChemRecord* record = rows[irow].records[ifile];
+	    if (!record) {
+		continue;
+	    }
+	    aligner.get_fields (*record, fields);
+	    for (int column = 0; column <= fields.size(); column++)
+	    {
+		aligner.get_field (*record, column, field);
+		if (field != (column < fields.size() ? fields[column] : "")) {
+		    fail (c, variant, "get_field differs from get_fields");
+		}
+	    }
+	}
+    }
+}
+
+static void check_variant (const Case& c, const Variant& variant,
+			   int expected_status, const std::string& expected)
+{
+    aligncsv::AlignOptions options;
+    options.single_header = c.single_header;
+    options.restricted = c.restricted;
+    options.lazy = variant.lazy;
+    options.LineTerminator = c.microsoft ? MICROSOFT_TERMINATOR :
+	UNIX_TERMINATOR;
+    aligncsv::Aligner aligner (options);
+    int status = 0;
+    for (int ifile = 0; ifile < c.files.size() && !status; ifile++)
+    {
+	const std::string& text = c.files[ifile];
+	if (variant.buffer) {
+	    status = aligner.add_buffer ("fuzz.csv", text.data(), text.size());
+	} else {
+	    std::istringstream in (text);
+	    status = aligner.add_stream ("fuzz.csv", in);
+	}
+    }
+    if (status != expected_status) {
+	std::ostringstream problem;
+	problem << "read status " << status << " (" << aligner.error()
+		<< "), expected " << expected_status;
+	fail (c, variant, problem.str().c_str());
+    }
+    if (status) {
+	return;
+    }
+    for (int pass = 0; pass < 2; pass++)
+    {
+	std::ostringstream out;
+	aligncsv::CsvSink sink (out, options.LineTerminator);
+	aligner.align (c.adiff, sink);
+	compare (c, variant, expected, out.str(),
+		 pass ? "second alignment" : "output");
+    }
+    check_fields (c, variant, aligner, c.adiff);
+}
+
+
+// The self-checked paths
+
+enum SelfMode {TWO_DIMENSIONS, BY_TIME, BY_CLASS, SEQUENTIAL_DP};
+
+class SelfCheck {
+public:
+    const char* name;
+    bool lazy;        // -l
+    SelfMode mode;
+};
+
+static const SelfCheck SELF_CHECKS[] = {
+    {"eager -d2 grid", false, TWO_DIMENSIONS},
+    {"lazy -d2 grid", true, TWO_DIMENSIONS},
+    {"eager --by-time", false, BY_TIME},
+    {"lazy --by-class", true, BY_CLASS},
+    {"eager --sequential-dp", false, SEQUENTIAL_DP}};
+#define NSELF_CHECKS (int) (sizeof SELF_CHECKS / sizeof SELF_CHECKS[0])
+
+typedef std::vector<std::vector<const aligncsv::ChemRecord*> > FileRecords;
+typedef std::pair<std::string,std::vector<const aligncsv::ChemRecord*> > Row;
+
+// A chemical's records in each file, highest time first (as in the
+//   library), returning whether every file has some
+
+static bool chemical_records (const aligncsv::Aligner& aligner,
+			      const std::string& chemical,
+			      FileRecords& records)
+{
+    bool in_all = true;
+    records.assign (aligner.nfiles(),
+		    std::vector<const aligncsv::ChemRecord*>());
+    for (int ifile = 0; ifile < aligner.nfiles(); ifile++)
+    {
+	const aligncsv::RecordMap& file_records = aligner.file(ifile).records;
+	aligncsv::RecordMap::const_iterator found = file_records.find (chemical);
+	if (found == file_records.end()) {
+	    in_all = false;
+	    continue;
+	}
+	for (int irec = 0; irec < found->second.size(); irec++)
+	{
+	    records[ifile].push_back (&found->second[irec]);
+	}
+    }
+    return in_all;
+}
+
+// -d2: each row starts from the lowest record left in any file, and takes
+//   from each other file the record left nearest to it within both
+//   tolerances (by the distance scaled by each tolerance, then the lowest
+//   time, then the later in sorted order)
+
+static void simple_two_dimensions (const Case& c,
+				   const aligncsv::Aligner& aligner,
+				   const std::string& chemical,
+				   std::vector<Row>& rows)
+{
+    FileRecords records;
+    if (!chemical_records (aligner, chemical, records) && c.restricted) {
+	return;
+    }
+    int nfiles = records.size();
+    std::vector<std::vector<bool> > taken (nfiles);
+    int ifile;
+    for (ifile = 0; ifile < nfiles; ifile++)
+    {
+	taken[ifile].assign (records[ifile].size(), false);
+    }
+    while (1) {
+	const aligncsv::ChemRecord* anchor = 0;
+	int anchor_file = -1;
+	int anchor_rec = -1;
+	bool exhausted = false;
+	for (ifile = 0; ifile < nfiles; ifile++)
+	{
+	    int irec = records[ifile].size() - 1;
+	    while (irec >= 0 && taken[ifile][irec]) {
+		irec--;
+	    }
+	    if (irec < 0) {
+		exhausted = true;
+	    } else if (!anchor || records[ifile][irec]->time1 < anchor->time1) {
+		anchor = records[ifile][irec];
+		anchor_file = ifile;
+		anchor_rec = irec;
+	    }
+	}
+	if (!anchor || (exhausted && c.restricted)) {
+	    return;
+	}
+	taken[anchor_file][anchor_rec] = true;
+	float cutoff = c.adiff < 1 ? (1 + c.adiff) * anchor->time1 :
+	    anchor->time1 + c.adiff;
+	float tolerance2 = c.adiff2 < 1 ? c.adiff2 * anchor->time2 : c.adiff2;
+	double scale1 = cutoff > anchor->time1 ? 1 / (cutoff - anchor->time1) :
+	    0;
+	double scale2 = tolerance2 > 0 ? 1 / tolerance2 : 0;
+
+	std::vector<const aligncsv::ChemRecord*> row (nfiles);
+	bool unfound = false;
+	for (ifile = 0; ifile < nfiles; ifile++)
+	{
+	    if (ifile == anchor_file) {
+		row[ifile] = anchor;
+		continue;
+	    }
+	    int best = -1;
+	    double best_distance = 0;
+	    for (int irec = 0; irec < records[ifile].size(); irec++)
+	    {
+		const aligncsv::ChemRecord* record = records[ifile][irec];
+		if (taken[ifile][irec] || record->time1 > cutoff) {
+		    continue;
+		}
+		double distance1 = (record->time1 - anchor->time1) * scale1;
+		double distance = distance1 * distance1;
+		if (anchor->time2 > 0 && record->time2 > 0) {
+		    if (std::abs (record->time2 - anchor->time2) > tolerance2) {
+			continue;
+		    }
+		    double distance2 = (record->time2 - anchor->time2) * scale2;
+		    distance += distance2 * distance2;
+		}
+		if (best < 0 || distance < best_distance ||
+		    (distance == best_distance &&
+		     (record->time1 < records[ifile][best]->time1 ||
+		      (record->time1 == records[ifile][best]->time1 &&
+		       irec > best))))
+		{
+		    best = irec;
+		    best_distance = distance;
+		}
+	    }
+	    if (best < 0) {
+		unfound = true;
+	    } else {
+		row[ifile] = records[ifile][best];
+		taken[ifile][best] = true;
+	    }
+	}
+	if (!unfound || !c.restricted) {
+	    rows.push_back (Row (chemical, row));
+	}
+    }
+}
+
+// --by-time (and --by-class): the records of each group (all of them, or
+//   those of one Class) are aligned by the rule of the chemical loop, as
+//   in the reference, sorting each file's records again on every pass.
+//   The rule only looks at times, so which of the records with the same
+//   time is taken doesn't change the rows' times, and the rows are
+//   compared by those (0 where a file has no record)
+
+typedef std::vector<float> RowTimes;
+
+static RowTimes row_times (const std::vector<const aligncsv::ChemRecord*>&
+			   records)
+{
+    RowTimes times (records.size(), 0);
+    for (int ifile = 0; ifile < records.size(); ifile++)
+    {
+	if (records[ifile]) {
+	    times[ifile] = records[ifile]->time1;
+	}
+    }
+    return times;
+}
+
+static void simple_by_time (const Case& c, const aligncsv::Aligner& aligner,
+			    bool by_class, std::vector<RowTimes>& rows)
+{
+    int nfiles = aligner.nfiles();
+    std::map<std::string,FileRecords> groups;
+    std::string key;
+    int ifile;
+    for (ifile = 0; ifile < nfiles; ifile++)
+    {
+	const aligncsv::RecordMap& file_records = aligner.file(ifile).records;
+	for (aligncsv::RecordMap::const_iterator it = file_records.begin();
+	     it != file_records.end(); ++it)
+	{
+	    for (int irec = 0; irec < it->second.size(); irec++)
+	    {
+		if (by_class) {
+		    aligner.get_field (it->second[irec], 0, key);
+		}
+		FileRecords& group = groups[key];
+		group.resize (nfiles);
+		group[ifile].push_back (&it->second[irec]);
+	    }
+	}
+    }
+    for (std::map<std::string,FileRecords>::iterator group = groups.begin();
+	 group != groups.end(); ++group)
+    {
+	FileRecords& records = group->second;
+	while (1) {
+	    std::vector<const aligncsv::ChemRecord*> lowest (nfiles);
+	    float lowest_time1 = 0;
+	    float second_lowest_time1 = 0;
+	    for (ifile = 0; ifile < nfiles; ifile++)
+	    {
+		std::vector<const aligncsv::ChemRecord*>& recs = records[ifile];
+		if (recs.empty()) {
+		    continue;
+		}
+		std::sort (recs.begin(), recs.end(),
+			   aligncsv::ChemRecord::higher_ptr);
+		lowest[ifile] = recs.back();
+		recs.pop_back();
+		if (lowest_time1 == 0 || lowest_time1 > lowest[ifile]->time1) {
+		    lowest_time1 = lowest[ifile]->time1;
+		}
+		if (!recs.empty() && (second_lowest_time1 == 0 ||
+				      second_lowest_time1 > recs.back()->time1)) {
+		    second_lowest_time1 = recs.back()->time1;
+		}
+	    }
+	    if (lowest_time1 == 0) {
+		break;
+	    }
+	    float cutoff = c.adiff < 1 ? (1 + c.adiff) * lowest_time1 :
+		lowest_time1 + c.adiff;
+	    bool complete = true;
+	    for (ifile = 0; ifile < nfiles; ifile++)
+	    {
+		const aligncsv::ChemRecord* record = lowest[ifile];
+		if (record && (record->time1 > cutoff ||
+			       record->time1 - lowest_time1 >
+			       std::abs (second_lowest_time1 - record->time1))) {
+		    records[ifile].push_back (record);
+		    lowest[ifile] = 0;
+		}
+		if (!lowest[ifile]) {
+		    complete = false;
+		}
+	    }
+	    if (complete || !c.restricted) {
+		rows.push_back (row_times (lowest));
+	    }
+	}
+    }
+}
+
+// Besides its times, each row must be named by the chemical (as kept by
+//   its file) of one of its lowest records, and no record may be in two
+//   rows
+
+static void check_by_time (const Case& c, const Variant& variant,
+			   const aligncsv::Aligner& aligner,
+			   const std::vector<aligncsv::AlignedRow>& aligned)
+{
+    std::map<const aligncsv::ChemRecord*,const std::string*> names;
+    int ifile;
+    for (ifile = 0; ifile < aligner.nfiles(); ifile++)
+    {
+	const aligncsv::RecordMap& file_records = aligner.file(ifile).records;
+	for (aligncsv::RecordMap::const_iterator it = file_records.begin();
+	     it != file_records.end(); ++it)
+	{
+	    for (int irec = 0; irec < it->second.size(); irec++)
+	    {
+		names[&it->second[irec]] = &it->first;
+	    }
+	}
+    }
+    std::set<const aligncsv::ChemRecord*> used;
+    std::vector<RowTimes> got;
+    for (int irow = 0; irow < aligned.size(); irow++)
+    {
+	const aligncsv::AlignedRow& row = aligned[irow];
+	got.push_back (row_times (row.records));
+	bool named = false;
+	for (ifile = 0; ifile < row.records.size(); ifile++)
+	{
+	    const aligncsv::ChemRecord* record = row.records[ifile];
+	    if (!record) {
+		continue;
+	    }
+	    if (!used.insert (record).second) {
+		fail (c, variant, "a record is in two rows");
+	    }
+	    if (record->time1 == row.time1 && names[record] == row.chemical) {
+		named = true;
+	    }
+	}
+	if (!named) {
+	    fail (c, variant, "a row isn't named by one of its lowest records");
+	}
+    }
+    std::vector<RowTimes> expected;
+    simple_by_time (c, aligner, aligner.options().by_class, expected);
+    std::sort (got.begin(), got.end());
+    std::sort (expected.begin(), expected.end());
+    if (got != expected) {
+	std::ostringstream problem;
+	problem << "row times differ from the simple version's ("
+		<< got.size() << " rows, expected " << expected.size() << ")";
+	fail (c, variant, problem.str().c_str());
+    }
+}
+
+// --sequential-dp with two files: each chemical's matching must be the
+//   best of every matching of the two files' records that keeps them in
+//   time order and within <diff> (the most records matched, then the
+//   least total difference), found by trying them all.  Chemicals with
+//   too many records to try them all are skipped.
+
+#define MAX_TRIED_RECORDS 16  // in both files together
+
+static float cutoff_time (float lowest_time1, float adiff)
+{
+    return adiff < 1 ? (1 + adiff) * lowest_time1 : lowest_time1 + adiff;
+}
+
+static void try_matchings (const std::vector<float>& times0,
+			   const std::vector<float>& times1, int first0,
+			   int first1, float adiff, int matches,
+			   double deviation, int& best_matches,
+			   double& best_deviation)
+{
+    if (matches > best_matches ||
+	(matches == best_matches && deviation < best_deviation)) {
+	best_matches = matches;
+	best_deviation = deviation;
+    }
+    for (int i0 = first0; i0 < times0.size(); i0++)
+    {
+	for (int i1 = first1; i1 < times1.size(); i1++)
+	{
+	    float lowest = std::min (times0[i0], times1[i1]);
+	    float highest = std::max (times0[i0], times1[i1]);
+	    if (highest <= cutoff_time (lowest, adiff)) {
+		try_matchings (times0, times1, i0 + 1, i1 + 1, adiff,
+			       matches + 1, deviation +
+			       std::abs ((double) times1[i1] - times0[i0]),
+			       best_matches, best_deviation);
+	    }
+	}
+    }
+}
+
+static void check_sequential_dp (const Case& c, const Variant& variant,
+				 const aligncsv::Aligner& aligner,
+				 const std::vector<aligncsv::AlignedRow>&
+				 aligned)
+{
+    if (aligner.nfiles() != 2) {
+	return;
+    }
+    std::map<std::string,int> matches;
+    std::map<std::string,double> deviations;
+    for (int irow = 0; irow < aligned.size(); irow++)
+    {
+	const aligncsv::AlignedRow& row = aligned[irow];
+	if (row.records[0] && row.records[1]) {
+	    matches[*row.chemical]++;
+	    deviations[*row.chemical] += std::abs
+		((double) row.records[1]->time1 - row.records[0]->time1);
+	}
+    }
+    std::set<std::string> chemicals;
+    const aligncsv::RecordMap& file_records = aligner.file(0).records;
+    for (aligncsv::RecordMap::const_iterator it = file_records.begin();
+	 it != file_records.end(); ++it)
+    {
+	chemicals.insert (it->first);
+    }
+    for (std::set<std::string>::const_iterator it = chemicals.begin();
+	 it != chemicals.end(); ++it)
+    {
+	FileRecords records;
+	chemical_records (aligner, *it, records);
+	if (records[0].size() + records[1].size() > MAX_TRIED_RECORDS) {
+	    continue;
+	}
+	std::vector<float> times[2];
+	for (int ifile = 0; ifile < 2; ifile++)
+	{
+	    for (int irec = records[ifile].size() - 1; irec >= 0; irec--)
+	    {
+		times[ifile].push_back (records[ifile][irec]->time1);
+	    }
+	}
+	int best_matches = 0;
+	double best_deviation = 0;
+	try_matchings (times[0], times[1], 0, 0, c.adiff, 0, 0, best_matches,
+		       best_deviation);
+	if (matches[*it] != best_matches ||
+	    std::abs (deviations[*it] - best_deviation) >
+	    1e-6 * (1 + best_deviation)) {
+	    std::ostringstream problem;
+	    problem << "matched " << matches[*it] << " records of " << *it
+		    << " with total difference " << deviations[*it]
+		    << ", but the best is " << best_matches << " with "
+		    << best_deviation;
+	    fail (c, variant, problem.str().c_str());
+	}
+    }
+}
+
+// Align a case with a self-checked path, and compare its rows with those
+//   of the simple version
+
+static void check_self (const Case& c, const SelfCheck& check,
+			int expected_status)
+{
+    Variant variant = {check.name, check.lazy, false, -1};
+    aligncsv::AlignOptions options;
+    options.single_header = c.single_header;
+    options.restricted = c.restricted;
+    options.lazy = check.lazy;
+    switch (check.mode) {
+    case TWO_DIMENSIONS:
+	options.adiff2 = c.adiff2;
+	break;
+    case BY_CLASS:
+	options.by_class = true;
+	options.by_time = true;
+	break;
+    case BY_TIME:
+	options.by_time = true;
+	break;
+    case SEQUENTIAL_DP:
+	options.sequential_dp = true;
+	break;
+    }
+    aligncsv::Aligner aligner (options);
+    int status = 0;
+    for (int ifile = 0; ifile < c.files.size() && !status; ifile++)
+    {
+	std::istringstream in (c.files[ifile]);
+	status = aligner.add_stream ("fuzz.csv", in);
+    }
+    if (status != expected_status) {
+	std::ostringstream problem;
+	problem << "read status " << status << " (" << aligner.error()
+		<< "), expected " << expected_status;
+	fail (c, variant, problem.str().c_str());
+    }
+    if (status) {
+	return;
+    }
+    std::vector<aligncsv::AlignedRow> aligned;
+    aligner.align_rows (c.adiff, aligned);
+    if (options.by_time) {
+	check_by_time (c, variant, aligner, aligned);
+	return;
+    }
+    if (options.sequential_dp) {
+	check_sequential_dp (c, variant, aligner, aligned);
+	return;
+    }
+    std::vector<Row> got;
+    for (int irow = 0; irow < aligned.size(); irow++)
+    {
+	got.push_back (Row (*aligned[irow].chemical, aligned[irow].records));
+    }
+
+    std::set<std::string> chemicals;
+    for (int ifile = 0; ifile < aligner.nfiles(); ifile++)
+    {
+	const aligncsv::RecordMap& file_records = aligner.file(ifile).records;
+	for (aligncsv::RecordMap::const_iterator it = file_records.begin();
+	     it != file_records.end(); ++it)
+	{
+	    chemicals.insert (it->first);
+	}
+    }
+    std::vector<Row> expected;
+    for (std::set<std::string>::const_iterator it = chemicals.begin();
+	 it != chemicals.end(); ++it)
+    {
+	simple_two_dimensions (c, aligner, *it, expected);
+    }
+    std::sort (got.begin(), got.end());
+    std::sort (expected.begin(), expected.end());
+    if (got != expected) {
+	std::ostringstream problem;
+	problem << "rows differ from the simple version's (" << got.size()
+		<< " rows, expected " << expected.size() << ")";
+	fail (c, variant, problem.str().c_str());
+    }
+}
+
+// Counts for the standalone summary
+
+static int cases_checked = 0;
+static int cases_rejected = 0;
+
+static void check_case (const Case& c)
+{
+    std::string expected;
+    int expected_status = reference_align (c, expected);
+    static const int startup_kernel = aligncsv::cpu_kernel();
+    variants_checked = 0;
+    for (int ivariant = 0; ivariant < NVARIANTS; ivariant++)
+    {
+	const Variant& variant = VARIANTS[ivariant];
+	if (variant.kernel >= 0 &&
+	    !aligncsv::set_cpu_kernel (variant.kernel)) {
+	    continue;
+	}
+	check_variant (c, variant, expected_status, expected);
+	aligncsv::set_cpu_kernel (startup_kernel);
+	variants_checked++;
+    }
+    for (int icheck = 0; icheck < NSELF_CHECKS; icheck++)
+    {
+	check_self (c, SELF_CHECKS[icheck], expected_status);
+	variants_checked++;
+    }
+    cases_checked++;
+    if (expected_status) {
+	cases_rejected++;
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput (const unsigned char* data,
+				       size_t size)
+{
+    Case c;
+    if (c.decode (data, size)) {
+	check_case (c);
+    }
+    return 0;
+}
+
+
+#ifndef LIBFUZZER
+
+// Small portable random number generator (xorshift, as in gen_chromatof)
+
+class Random {
+public:
+    Random (unsigned long seed) {state = seed * 2654435761UL + 1;}
+    double uniform () {      // 0 <= u < 1
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	state &= 0xffffffffUL;
+	return state / 4294967296.0;
+    }
+    int below (int n) {return (int) (n * uniform());}
+    bool chance (double p) {return uniform() < p;}
+    template <class T>
+    const T& pick (const std::vector<T>& items)
+	{return items[below (items.size())];}
+private:
+    unsigned long state;
+};
+
+// The awkward values cases are made of
+
+static const char* NAMES[] = {
+    "Analyte", "\"Analyte\"", "\"1,3,5-Triol\"", "\"Cyclohexane, 2-methyl-\"",
+    "\"Say \"\"hi\"\", twice\"", "\"a\"\"\"", "\"\"", "Unknown",
+    "Unknown\r", "", "Peak", "\"Unknown 12\""};
+static const char* ODD_NAMES[] = {   // quoting that moves the time field
+    "\"", "\"x\",y", "a\"b,c\"d", "\"\"\",\"", "Cyclohexane, 2-methyl-"};
+static const char* TIMES[] = {
+    "100", "\"100\"", "100.5", "\"105\"", "99", "1e2", "200", "101",
+    "\"100\"\r", "1000", "1005", "\"995\"", "2", "3", "3.0000001"};
+static const char* TIMES2[] = {
+    "1.5", "\"1.5\"", "1.52", "1.4", "2", "0.5", "3.25", "\"2.01\"", "1.5x"};
+static const char* BAD_TIMES[] = {
+    "0", "abc", "", "\"\"", "nan", "100x", "\"1\"2", "\"-5\""};
+static const char* CLASSES[] = {
+    "Class1", "\"Class1\"", "", "\"\"", "\"Aromatic, 2\"", "A\rB"};
+static const char* FIELDS[] = {
+    "", "\"\"", "\"1,2\"", "\"a\"\"b\"", "3.14", "\"x\"\"\",y", "Class1",
+    "\"Class1\"", "\r", "a\rb", " ", "\"\"\"\"", "123456", "\"S/N\""};
+static const char* COLUMNS[] = {
+    "Class", "1st Dimension Time (s)", "\"2nd Dimension Time (s)\"",
+    "Area", "\"S/N\"", "Quant Masses", "\"Spectra\""};
+static const char* SAMPLES[] = {
+    "\"Sample 1:1\"", "Sample 2", "\"S 3\"", "\"Q\"\"4\"", "X"};
+static const char* LINE_ENDS[] = {"\n", ",\n", ",\r\n", ",\r\r\n", "\r\n"};
+static const char* STRAYS[] = {",", "\"", "\r", "\n", " ", "\"\"", ",,"};
+
+#define LIST(array) std::vector<std::string> \
+    (array, array + sizeof array / sizeof array[0])
+
+static void generate_file (Random& random, std::string& file)
+{
+    static const std::vector<std::string> names = LIST (NAMES);
+    static const std::vector<std::string> odd_names = LIST (ODD_NAMES);
+    static const std::vector<std::string> times = LIST (TIMES);
+    static const std::vector<std::string> times2 = LIST (TIMES2);
+    static const std::vector<std::string> bad_times = LIST (BAD_TIMES);
+    static const std::vector<std::string> classes = LIST (CLASSES);
+    static const std::vector<std::string> fields = LIST (FIELDS);
+    static const std::vector<std::string> columns = LIST (COLUMNS);
+    static const std::vector<std::string> samples = LIST (SAMPLES);
+    static const std::vector<std::string> line_ends = LIST (LINE_ENDS);
+
+    std::string line_end = random.pick (line_ends);
+    std::string header_end = line_end;
+    if (line_end.compare (0, 2, ",\r") && random.chance (0.9)) {
+	header_end = ",\r\n";  // else the first header seems short
+    }
+    int nsamples = 1 + random.below (3);
+    int ncolumns = 2 + random.below (4);   // per sample, after Peak
+    int width = nsamples * ncolumns;       // data columns
+
+// Headers: usually two, the first naming each sample over its columns
+
+    file.clear();
+    if (random.chance (0.7)) {
+	for (int isample = 0; isample < nsamples; isample++)
+	{
+	    file += "," + random.pick (samples);
+	    file += std::string (ncolumns - 1, ',');
+	}
+	file += header_end;
+    }
+    file += random.chance (0.8) ? "Peak" : "\"Peak\"";
+    for (int icol = 0; icol < width; icol++)
+    {
+	file += ",";
+	if (random.chance (0.02)) {
+	    file += " ";  // virtually empty
+	} else {
+	    file += icol % ncolumns ? random.pick (columns) : "Class";
+	}
+    }
+    file += header_end;
+
+// Rows, a few chemicals and times so that duplicates and ties are common
+
+    std::vector<std::string> chem_pool;
+    std::vector<std::string> time_pool;
+    int npool = 1 + random.below (4);
+    for (int ipool = 0; ipool < npool; ipool++)
+    {
+	chem_pool.push_back (random.chance (0.02) ? random.pick (odd_names) :
+			     random.pick (names));
+	time_pool.push_back (random.pick (times));
+    }
+    int nrows = random.below (25);
+    int bad_row = random.chance (0.05) ? random.below (nrows + 1) : -1;
+    std::string row;
+    for (int irow = 0; irow < nrows; irow++)
+    {
+	if (irow == 0 || !random.chance (0.3)) {
+	    row = random.pick (chem_pool) + ",";
+	    row += random.pick (classes);
+	    row += ",";
+	    row += irow == bad_row ? random.pick (bad_times) :
+		random.chance (0.8) ? random.pick (time_pool) :
+		random.pick (times);
+	    int nfields = width - 2 + random.below (5) - 2;
+	    for (int ifield = 0; ifield < nfields; ifield++)
+	    {
+		row += ",";
+		row += ifield == 0 && random.chance (0.8) ?
+		    random.pick (times2) : random.pick (fields);
+	    }
+	    row += random.chance (0.9) ? line_end : random.pick (line_ends);
+	}
+	file += row;   // else a duplicate of the row before
+    }
+    if (!file.empty() && random.chance (0.1)) {
+	file.erase (file.length() - 1);  // no final newline
+    }
+}
+
+static void generate_case (Random& random, Case& c)
+{
+    static const std::vector<std::string> strays = LIST (STRAYS);
+    c.single_header = random.chance (0.3);
+    c.microsoft = random.chance (0.3);
+    c.restricted = random.chance (0.3);
+    c.adiff = DIFFS[random.below (NDIFFS)];
+    c.adiff2 = DIFFS[random.below (NDIFFS)];
+    c.files.resize (1 + random.below (4));
+    for (int ifile = 0; ifile < c.files.size(); ifile++)
+    {
+	std::string& file = c.files[ifile];
+	generate_file (random, file);
+	while (!file.empty() && random.chance (0.1)) {
+	    file.insert (random.below (file.length()), random.pick (strays));
+	}
+    }
+}
+
+// A case that doesn't finish (e.g. an alignment loop that never ends) is
+//   reported by its seed or file, as describing it here isn't safe
+
+static void hang (int)
+{
+    const char message[] = "\n*** case did not finish: ";
+    write (2, message, sizeof message - 1);
+    write (2, case_label.data(), case_label.length());
+    write (2, "\n", 1);
+    abort();
+}
+
+static bool read_case (const char* filename, Case& c)
+{
+    std::ifstream in (filename, std::ios::binary);
+    if (in.fail()) {
+	std::cerr << "No Such File: " << filename << "\n";
+	return false;
+    }
+    std::string data ((std::istreambuf_iterator<char>(in)),
+		      std::istreambuf_iterator<char>());
+    if (!c.decode ((const unsigned char*) data.data(), data.size())) {
+	std::cerr << filename << " is too short to be a case\n";
+	return false;
+    }
+    return true;
+}
+
+int main (int argc, char** argv)
+{
+    int ncases = 10000;
+    unsigned long seed = 1;
+    const char* corpus = 0;
+    std::vector<const char*> casefiles;
+    for (int iarg = 1; iarg < argc; iarg++)
+    {
+	if (!strcmp (argv[iarg], "-n") && iarg + 1 < argc) {
+	    ncases = atoi (argv[++iarg]);
+	} else if (!strcmp (argv[iarg], "-x") && iarg + 1 < argc) {
+	    seed = strtoul (argv[++iarg], 0, 10);
+	} else if (!strcmp (argv[iarg], "-w") && iarg + 1 < argc) {
+	    corpus = argv[++iarg];
+	} else if (argv[iarg][0] == '-') {
+	    std::cerr << "Usage: fuzz_aligncsv [-n <cases>] [-x <seed>] "
+		"[-w <dir>] [<case file>]*\n";
+	    return -1;
+	} else {
+	    casefiles.push_back (argv[iarg]);
+	}
+    }
+
+    signal (SIGALRM, hang);
+    if (!casefiles.empty()) {
+	for (int icase = 0; icase < casefiles.size(); icase++)
+	{
+	    Case c;
+	    if (!read_case (casefiles[icase], c)) {
+		return -1;
+	    }
+	    case_label = casefiles[icase];
+	    alarm (HANG_SECONDS);
+	    check_case (c);
+	}
+    } else {
+	for (int icase = 0; icase < ncases; icase++)
+	{
+	    Random random (seed + icase);
+	    Case c;
+	    generate_case (random, c);
+	    if (corpus) {
+		std::ostringstream filename;
+		filename << corpus << "/case-" << seed + icase;
+		std::ofstream out (filename.str().c_str(), std::ios::binary);
+		out << c.encode();
+		if (out.fail()) {
+		    std::cerr << "Unable to write " << filename.str() << "\n";
+		    return -10;
+		}
+	    }
+	    std::ostringstream label;
+	    label << "seed " << seed + icase;
+	    case_label = label.str();
+	    alarm (HANG_SECONDS);
+	    if (icase % 1000 == 0) {
+		std::cout << "." << std::flush;
+	    }
+	    check_case (c);
+	}
+	std::cout << "\n";
+    }
+    std::cout << cases_checked << " cases checked against "
+	      << variants_checked << " library paths (" << cases_rejected
+	      << " rejected by all as bad data), no differences\n";
+    return 0;
+}
+
+#endif
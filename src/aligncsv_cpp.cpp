@@ -1,787 +1,693 @@
 #include <Rcpp.h>
+#include "libaligncsv.h"
 
-// Filename: aligncsv.cc
-// Purpose: align multiple csv files produced by Chromatof
-// Author: Charles Peterson, Texas Biomed, August 2017
-// Usage: aligncsv [-1] [-d <diff>] [-o <outfile>] [-m] [<filename>]+
-//        -1 means force one line header on output (not required if
-//           there is only one header anyway)
-//        -d <diff> is floating point fraction < 1 (proportion) or integer
-//           (arithmetic difference) by which 1st dimension time can vary in
-//           the same record (defaults to 0.01 meaning 1%), only first time
-//           in any record is checked
-//        -o <outfile> write to this file instead of aligncsv.csv
-//        -m Use "microsoft" excel formatting with trailing comma
-//        -r Restrict output to chemical and time found in all files
+// Filename: aligncsv_cpp.cpp
+// Purpose: R interface to libaligncsv (align multiple csv files produced
+//   by Chromatof)
 //
-// Output: aligncsv.csv file is written to working directory.
-//
-// Notes: Input file(s) may have 2 headers, or one header
-//
-// If the first header has blank columns, a second header is required.
-// A first header consists of qualifiers to the second header fields
-//   and the first header name repeats for all blank columns until
-//   the next nonblank name appears.
-//
-// Default is to output header(s) in same form as input.
-//
-// Optionally, the two header form can be changed to a one header form
-//   for compatibility with other software by specifying option -1.
-//   In this case, the first header fields become suffixes to the
-//   second header fields, using the HEADER_SEPARATOR defined below as @
-//
-// Files are joined horizontally, based on matching entries in the first
-//   column ("peak", which identifies the peptide chemical), and matching
-//   the first dimension time within the diff value.
-//
-// The peak column is written ONLY to the first column in the output file,
-//   and not repeated for each of the subsequent file(s) which are being
-//   joined.
+// This file used to carry its own copy of the aligncsv program.  The R
+//   functions below now use the same library as the aligncsv command
+//   (libaligncsv.h and libaligncsv.cc, which must be compiled along with
+//   this file), so both align files the same way.  See aligncsv_v4.cc for
+//   the file format and alignment rules.
+//-
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+
+
+
+// **** R INTERFACE //
 //
-// When some files are missing particular "peak" values, their columns have
-//   no (aka null) entries, with commas separating them as always.
+// align_frames() aligns files that are already in R, without writing and
+//   reading back temporary csv files.  It uses libaligncsv (libaligncsv.cc
+//   must be compiled along with this file).
 //
-// Microsoft-excel-style trailing commas after the last valid field are removed
-//    unless the -m option is specified.
+// Each element of inputs is either
+//   a raw vector holding the contents of a Chromatof csv file
+//     (e.g. readBin(file, "raw", file.size(file))), or
+//   a data frame read from one with
+//     read.csv(file, header = FALSE, stringsAsFactors = FALSE)
+//     so that its first row(s) are the header(s), as R/test.R does.
+//     Data frames are joined back into csv text in memory.
+// Chemicals are matched by their names without quotes (which read.csv
+//   removes), so raw vectors and data frames can be aligned together.
+// The names of inputs, if any, are used as file names in messages.
 //
-// When run on linux, this program will terminate lines as Unix does, with \n.
-// If this program is compiled on Windows, it should terminate lines like 
-// Windows.
+// diff and restricted are the -d and -r options of aligncsv, and diff2
+//   (if given) the -d2 option, aligning on the 2nd dimension time too.
 //
-// When the file is copied to the other platform, generally the system will do
-//   the required conversion.
+// The result is a data frame with the chemical in the first column and the
+//   data columns of each file following, named with the composite
+//   (name@sample) header names.  Rows are in time order.  It is built
+//   directly column by column (no csv text is formatted), and columns
+//   whose values are all numbers (or empty) are numeric.  Quotes around
+//   values are removed, and missing values are NA.
 //
-// Double quoted fields are written double quoted to the output file as well.
-//-
+// With lazy_columns = TRUE (the default where R supports ALTREP lists, R
+//   4.3 or later) the data frame is an ALTREP list pointing into the
+//   aligned records kept in C++, and making it splits no records.  The
+//   first time R uses a data column, each record of that column's file is
+//   split once and all of the file's columns are decoded, and typed the
+//   same way as eager columns, so both give identical frames.  The records
+//   are freed with the frame.
 
+// Get the values of a data frame column as strings (NA as empty)
 
-#define MAXFILES 1000         // may be increased to system limits
-#define HEADER_SEPARATOR "@"  // this must not be used in column names
-#define UNIX_TERMINATOR "\n"
+static std::vector<std::string> column_strings (SEXP column)
+{
+    std::vector<std::string> values;
+    if (Rf_isFactor (column)) {
+	Rcpp::IntegerVector codes (column);
+	Rcpp::CharacterVector levels = codes.attr ("levels");
+	for (int irow = 0; irow < codes.size(); irow++)
+	{
+	    if (codes[irow] == NA_INTEGER) {
+		values.push_back ("");
+	    } else {
+		values.push_back (Rcpp::as<std::string>(levels[codes[irow]-1]));
+	    }
+	}
+    } else {
+	Rcpp::CharacterVector strings = Rcpp::as<Rcpp::CharacterVector>(column);
+	for (int irow = 0; irow < strings.size(); irow++)
+	{
+	    if (Rcpp::CharacterVector::is_na (strings[irow])) {
+		values.push_back ("");
+	    } else {
+		values.push_back (Rcpp::as<std::string>(strings[irow]));
+	    }
+	}
+    }
+    return values;
+}
 
-// #define MICROSOFT_TERMINATOR ",\r\n"
-// this doesn't work.  standard library elides \r on linux systems
-// and adds it on Windows systems
+// Join a data frame read with header = FALSE back into csv text
+//   Values having commas or quotes are quoted (read.csv removed the quotes).
+//   Lines end with \r\n, as Chromatof's do, so that the empty last column
+//   read.csv makes of a trailing comma is dropped from the headers just as
+//   the trailing comma would be.
 
-#define MICROSOFT_TERMINATOR ",\n"
+static std::string frame_text (Rcpp::DataFrame frame)
+{
+    std::vector<std::vector<std::string> > columns;
+    for (int icol = 0; icol < frame.size(); icol++)
+    {
+	columns.push_back (column_strings (frame[icol]));
+    }
+    std::string text;
+    int nrows = columns.empty() ? 0 : columns[0].size();
+    for (int irow = 0; irow < nrows; irow++)
+    {
+	for (int icol = 0; icol < columns.size(); icol++)
+	{
+	    if (icol > 0) {
+		text += ",";
+	    }
+	    const std::string& value = columns[icol][irow];
+	    if (value.find_first_of (",\"") != std::string::npos) {
+		text += "\"";
+		for (int ich = 0; ich < value.length(); ich++)
+		{
+		    if (value[ich] == '"') {
+			text += "\"";
+		    }
+		    text += value[ich];
+		}
+		text += "\"";
+	    } else {
+		text += value;
+	    }
+	}
+	text += "\r\n";
+    }
+    return text;
+}
 
-// STDPRE defines the prefix needed to get C++11 functionality
-// TR1 is needed if compiler is pre C++11 (e.g. gcc 4.4.7)
-// Comment this out for C++11 compliant compilers
-//#define TR1 1
+// Collects aligned rows as columns of strings
 
-#ifdef TR1
-#define STDPRE std::tr1
-#define ABS abs
-#else
-#define STDPRE std
-#define ABS std::abs
-#endif
+class FrameSink {
+public:
+    std::vector<std::vector<std::string> > columns;  // chemical first
+    void header (const std::string&) {}
+    void row (const aligncsv::Aligner& aligner,
+	      const aligncsv::AlignedRow& row);
+private:
+    std::vector<std::string> fields;
+};
 
-#include <string.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <errno.h>
-#include <string>
-#include <iostream>
-#include <vector>
-#include <fstream>
-#include <sstream>
-#include <set>
-#include <cctype>
-#include <algorithm>
+static std::string unquote_value (const std::string& value)
+{
+    if (value.length() > 1 && value[0] == '"' &&
+	value[value.length()-1] == '"') {
+	return value.substr (1, value.length()-2);
+    }
+    return value;
+}
 
-#ifdef TR1
-// tr1 update required for unordered_map on pre-C++11 compilers
-#include <tr1/unordered_map> // removed to moke C++11 compliant
-#else
-#include <unordered_map>
-#endif
+void FrameSink::row (const aligncsv::Aligner& aligner,
+		     const aligncsv::AlignedRow& row)
+{
+    int icol = 0;
+    if (columns.empty()) {
+	columns.resize (1);
+    }
+    columns[icol++].push_back (*row.chemical);  // already unquoted
+    for (int ifile = 0; ifile < aligner.nfiles(); ifile++)
+    {
+	int data_columns = aligner.data_columns (ifile);
+	fields.clear();
+	if (row.records[ifile]) {
+	    aligner.get_fields (*row.records[ifile], fields);
+	}
+	for (int column = 0; column < data_columns; column++, icol++)
+	{
+	    if (icol >= columns.size()) {
+		columns.resize (icol + 1);
+	    }
+	    if (column < fields.size()) {
+		columns[icol].push_back (unquote_value (fields[column]));
+	    } else {
+		columns[icol].push_back ("");
+	    }
+	}
+    }
+}
 
-using std::ofstream;
+// Make an R vector from a column of strings, numeric if possible
 
-STDPRE::unordered_map<std::string, std::string>Table;  // all field data
-std::set<std::string>Chemicals; // just the chemical names
-std::vector<std::string> Header;
-std::vector<std::string> Header1;
-std::vector<std::string> Header2;
-std::vector<std::string> Filenames;
-std::vector<int> DataColumns;
+static SEXP column_vector (const std::vector<std::string>& values)
+{
+    int nrows = values.size();
+    Rcpp::NumericVector numbers (nrows);
+    bool numeric = true;
+    for (int irow = 0; numeric && irow < nrows; irow++)
+    {
+	const char* text = values[irow].c_str();
+	char* ppend;
+	if (*text == '\0') {
+	    numbers[irow] = NA_REAL;
+	} else {
+	    numbers[irow] = strtod (text, &ppend);
+	    if (*ppend != '\0') {
+		numeric = false;
+	    }
+	}
+    }
+    if (numeric) {
+	return numbers;
+    }
+    Rcpp::CharacterVector strings (nrows);
+    for (int irow = 0; irow < nrows; irow++)
+    {
+	if (values[irow].empty()) {
+	    strings[irow] = NA_STRING;
+	} else {
+	    strings[irow] = values[irow];
+	}
+    }
+    return strings;
+}
 
-// A single input record
-class ChemRecord {
-public:
-    std::vector<std::string> fields;  // data fields following chemical
-    float time1;
-    float time2;
-    static bool higher (ChemRecord c1, ChemRecord c2) 
-    {return c1.time1 > c2.time1;}
-    int nfields () {return fields.size();}
-};
+// Read each input into the aligner, stopping with an error if one can't be
 
-ChemRecord NA;
+static void read_inputs (Rcpp::List inputs, aligncsv::Aligner& aligner)
+{
+    Rcpp::CharacterVector input_names;
+    if (inputs.hasAttribute ("names")) {
+	input_names = inputs.names();
+    }
+    for (int ifile = 0; ifile < inputs.size(); ifile++)
+    {
+	std::ostringstream name;
+	if (ifile < input_names.size() &&
+	    Rcpp::as<std::string>(input_names[ifile]).length()) {
+	    name << Rcpp::as<std::string>(input_names[ifile]);
+	} else {
+	    name << "input " << ifile + 1;
+	}
+	SEXP input = inputs[ifile];
+	int status;
+	if (TYPEOF (input) == RAWSXP) {
+	    Rcpp::RawVector raw (input);
+	    const char* data = raw.size() ? 
+		reinterpret_cast<const char*>(&raw[0]) : "";
+	    status = aligner.add_buffer (name.str(), data, raw.size());
+	} else if (Rf_inherits (input, "data.frame")) {
+	    std::string text = frame_text (Rcpp::DataFrame (input));
+	    status = aligner.add_buffer (name.str(), text.data(),
+					 text.size());
+	} else {
+	    Rcpp::stop ("input " + name.str() +
+			" is not a raw vector or data frame");
+	}
+	if (status) {
+	    Rcpp::stop (aligner.error());
+	}
+    }
+}
 
-// All the records in one file
-STDPRE::unordered_map<std::string,std::vector<ChemRecord> > FileData;
+// LAZY (ALTREP) FRAMES
+//
+// The aligned rows and the Aligner holding their records are kept in an
+//   AlignedStore.  A lazy frame is an ALTREP list whose data1 is the store
+//   (as an external pointer) and whose data2 is a plain list of the
+//   columns decoded so far (NULL for the others).  An ALTREP vector needs
+//   its type when it is made, which would mean reading every field of its
+//   column then, so it is the list that is lazy: the first time R takes
+//   a data column of some file, each row's record for that file is split
+//   once and all of that file's columns are decoded by column_vector.
 
-// All the records in all the files
-std::vector<STDPRE::unordered_map<std::string,std::vector<ChemRecord> > >AllFileData;
+#if defined(R_VERSION) && R_VERSION >= R_Version(4, 3, 0)
+#define ALIGNCSV_ALTLIST 1
+#include <R_ext/Altrep.h>
 
-// A single output line (including data from all files)
-class OutputRecord {
+class AlignedStore {
 public:
-    OutputRecord (std::string inputline, float intime1)
-    {line=inputline;time1=intime1;}
-    std::string line;
-    float time1;
-    static bool lower (OutputRecord r1, OutputRecord r2)
-    {return r1.time1 < r2.time1;}
+    AlignedStore (const aligncsv::AlignOptions& options) :
+	aligner(options), splits(0) {}
+    aligncsv::Aligner aligner;
+    std::vector<aligncsv::AlignedRow> rows;
+    std::vector<int> file_of;       // each column's file, -1 for chemical
+    std::vector<int> first_column;  // each file's first column
+    double splits;                  // records split so far
 };
 
-std::vector<OutputRecord> OutputLines;
+static R_altrep_class_t lazy_frame_class;
+
+static AlignedStore* frame_store (SEXP x)
+{
+    return static_cast<AlignedStore*>(R_ExternalPtrAddr (R_altrep_data1 (x)));
+}
+
+static R_xlen_t lazy_length (SEXP x)
+{
+    return frame_store (x)->file_of.size();
+}
+
+// Decode the columns of one file (those not already set) into data2
+
+static void decode_file (SEXP x, int ifile)
+{
+    AlignedStore* store = frame_store (x);
+    const aligncsv::Aligner& aligner = store->aligner;
+    int data_columns = aligner.data_columns (ifile);
+    std::vector<std::vector<std::string> > columns (data_columns);
+    std::vector<std::string> fields;
+    for (int irow = 0; irow < store->rows.size(); irow++)
+    {
+	const aligncsv::ChemRecord* record = store->rows[irow].records[ifile];
+	fields.clear();
+	if (record) {
+	    aligner.get_fields (*record, fields);
+	    store->splits++;
+	}
+	for (int column = 0; column < data_columns; column++)
+	{
+	    if (column < fields.size()) {
+		columns[column].push_back (unquote_value (fields[column]));
+	    } else {
+		columns[column].push_back ("");
+	    }
+	}
+    }
+    SEXP decoded = R_altrep_data2 (x);
+    for (int column = 0; column < data_columns; column++)
+    {
+	int icol = store->first_column[ifile] + column;
+	if (VECTOR_ELT (decoded, icol) == R_NilValue) {
+	    SET_VECTOR_ELT (decoded, icol, column_vector (columns[column]));
+	}
+	std::vector<std::string>().swap (columns[column]);
+    }
+}
+
+static SEXP lazy_elt (SEXP x, R_xlen_t icol)
+{
+    SEXP decoded = R_altrep_data2 (x);
+    if (VECTOR_ELT (decoded, icol) == R_NilValue) {
+	decode_file (x, frame_store (x)->file_of[icol]);
+    }
+    return VECTOR_ELT (decoded, icol);
+}
 
+static void lazy_set_elt (SEXP x, R_xlen_t icol, SEXP value)
+{
+    SET_VECTOR_ELT (R_altrep_data2 (x), icol, value);
+}
 
+static Rboolean lazy_inspect (SEXP x, int pre, int deep, int pvec,
+			      void (*inspect_subtree)(SEXP, int, int, int))
+{
+    SEXP decoded = R_altrep_data2 (x);
+    int ndecoded = 0;
+    for (R_xlen_t icol = 0; icol < Rf_xlength (decoded); icol++)
+    {
+	if (VECTOR_ELT (decoded, icol) != R_NilValue) {
+	    ndecoded++;
+	}
+    }
+    Rprintf ("aligncsv lazy frame (%d of %d columns decoded)\n", ndecoded,
+	     (int) Rf_xlength (decoded));
+    return TRUE;
+}
 
-// **** MAIN PROGRAM BEGINS HERE //
+// The class is made when the package is loaded, or (as under
+//   Rcpp::sourceCpp, which doesn't run Rcpp::init functions) when the first
+//   lazy frame is made
 
-int main (int argc, char** argv) {
-    std::string LineTerminator = UNIX_TERMINATOR;
-    float adiff = 0.01;
-    bool afraction = true;
-    std::ifstream infile[MAXFILES];  // std::vector not possible for ifstream
-    int ninfiles = 0;
-    std::string outname = "aligncsv.csv";
-    int single_header = 0;
-    bool restricted = false;
+static void make_lazy_classes (DllInfo* dll)
+{
+    lazy_frame_class = R_make_altlist_class ("aligncsv_frame", "aligncsv",
+					     dll);
+    R_set_altrep_Length_method (lazy_frame_class, lazy_length);
+    R_set_altrep_Inspect_method (lazy_frame_class, lazy_inspect);
+    R_set_altlist_Elt_method (lazy_frame_class, lazy_elt);
+    R_set_altlist_Set_elt_method (lazy_frame_class, lazy_set_elt);
+}
 
-// parse arguments and open files
+// [[Rcpp::init]]
+void aligncsv_init_altrep (DllInfo* dll)
+{
+    make_lazy_classes (dll);
+}
+
+// Align the inputs into a new store and return a data frame whose chemical
+//   column is decoded and whose data columns are not
+
+static Rcpp::DataFrame lazy_frame (Rcpp::List inputs, double diff,
+				   const aligncsv::AlignOptions& options)
+{
+    if (lazy_frame_class.ptr == NULL) {
+	make_lazy_classes (R_getEmbeddingDllInfo());
+    }
+    Rcpp::XPtr<AlignedStore> xstore (new AlignedStore (options), true);
+    AlignedStore* store = xstore.get();
+    read_inputs (inputs, store->aligner);
+    store->aligner.align_rows (diff, store->rows);
 
-    if (argc < 2) {
-    std::cout << "Usage: aligncsv [-1] [-d <diff>] [<filename>]+\n";
-    std::cout << "-1 force two headers to one\n";
-    std::cout << "-d <diff> sets maximum alignment difference, default is .01 for 1%\n";
-    std::cout << "   >1 will set integer difference, 0 means must be exactly same\n";
-    std::cout << "-o <outfile> output to this file (default is aligncsv.csv)\n";
-    std::cout << "-m use trailing comma format like Microsoft does\n";
-    std::cout << "-r restrict to chemical/times found in all files\n";
-    return 0;
+    const aligncsv::Aligner& aligner = store->aligner;
+    std::vector<std::string> names;
+    aligner.column_names (names);
+    int nrows = store->rows.size();
+    store->file_of.push_back (-1);
+    for (int ifile = 0; ifile < aligner.nfiles(); ifile++)
+    {
+	store->first_column.push_back (store->file_of.size());
+	store->file_of.resize (store->file_of.size() +
+			       aligner.data_columns (ifile), ifile);
     }
 
-    int iarg = 1;
-    int starg = 0;
-    while (iarg > starg)
+    Rcpp::List decoded (store->file_of.size());
+    Rcpp::CharacterVector chemicals (nrows);
+    for (int irow = 0; irow < nrows; irow++)
     {
-    starg = iarg;
-    
-    if (!strcmp(argv[iarg],"-1")) {
-        single_header = 1;
-        iarg++;
-    }
-    if (!strcmp(argv[iarg],"-d")) {
-        iarg++;
-        if (argc < 3) {
-        std::cerr << "-d requires <diff> specification\n";
-        return -1;
-        }
-        char* ppend;
-        adiff = strtof (argv[iarg],&ppend);
-        if (adiff < 0 || *ppend != 0) {
-        std::cerr << "<diff> specification must be >= 0\n";
-        return -1;
-        }
-        if (adiff >= 1) {
-        afraction = false;
-        }
-        iarg++;
-    }
-    if (!strcmp(argv[iarg],"-o")) {
-        iarg++;
-        if (argc < 3) {
-        std::cerr << "-o requires <outfilename> specification\n";
-        return -1;
-        }
-        if (FILE *testfile = fopen (argv[iarg],"r")) {
-        fclose (testfile);
-        std::cerr << "file named " << argv[iarg] << 
-            " already exists and must be deleted first\n";
-        return -1;
-        }
-        outname = argv[iarg];
-        iarg++;
-    }
-    if (!strcmp(argv[iarg],"-m")) {
-        LineTerminator = MICROSOFT_TERMINATOR;
-        iarg++;
-    }
-    if (!strcmp(argv[iarg],"-r")) {
-        restricted = true;
-        iarg++;
-    }
-    }
-
-    std::ofstream outfile;
-    outfile.open(outname.c_str());
-    if (outfile.fail()) {
-      std::cerr << "Unable to open output file\n";
-      return -10;
-    }
-    // This section collects all of the filenames into a charcter string 
-    // Filenames and ensures they can be opened
-    // If a file cannot be found an error message beginning with "No such file:" 
-    // is generated. 
-    // If a file cannot be opend an error message of "File ", file_name, 
-    // " was not opened\n" is generated.
-    int first_file_index = iarg;
-    
-    for (; iarg < argc; iarg++) {
-        if (ninfiles >= MAXFILES) {
-            std::cerr << "Maximum " << MAXFILES <<
-            " number of files exceeded";
-            return -1;
-        }
-        int ifile = iarg - first_file_index;
-        infile[ifile].open (argv[iarg]);
-        if (infile[ifile].fail()) {
-            std::cerr << "No Such File: " << argv[iarg] << "\n";
-            return -1;
-        }
-        if (!infile[ifile].is_open()) {
-            std::cerr << "File " << argv[iarg] << " was not opened\n";
-            return -1;
-        }
-        ninfiles++;
-        Filenames.push_back(argv[iarg]);
-        DataColumns.push_back(0);
-    }
-    
-    // Read In Files
-    
+	chemicals[irow] = *store->rows[irow].chemical;
+    }
+    decoded[0] = chemicals;
+
+    Rcpp::List result (R_new_altrep (lazy_frame_class, xstore, decoded));
+    result.attr ("names") = Rcpp::wrap (names);
+    result.attr ("row.names") = Rcpp::IntegerVector::create (NA_INTEGER,
+							      -nrows);
+    result.attr ("class") = "data.frame";
+    return Rcpp::DataFrame (result);
+}
+#endif
+
+// The number of records a lazy frame has split so far (NA for any other
+//   object), for R/test_align_frames.R
+
+// [[Rcpp::export]]
+double lazy_frame_splits (SEXP frame)
+{
+#ifdef ALIGNCSV_ALTLIST
+    if (R_altrep_inherits (frame, lazy_frame_class)) {
+	return frame_store (frame)->splits;
+    }
+#endif
+    return NA_REAL;
+}
+
+// HEADER SPLITTER
+//
+// separate_header_file() reads a Chromatof csv file (a path, or a raw
+//   vector of its contents) and splits off its header(s) using the same
+//   rules as aligncsv: a first header with counted empty names needs a
+//   second header, and a trailing empty or "virtually empty" field (the
+//   Microsoft trailing comma) is not a column.  The data rows are read
+//   straight into typed columns (numeric where all values are numbers).
+//
+// The result has the same form as separate_header() in R/separate_header.R,
+//   list(header = list(header1, header2), data = <data frame>).  The
+//   columns are named with the composite (name@sample) names aligncsv -1
+//   writes, or with joined_names = TRUE (as separate_header() calls it)
+//   header1_header2 like separate_header()'s, and the headers are then
+//   also returned as written rather than with empty names filled in.
+//   With remove_trailers = FALSE, data fields past the named columns are
+//   kept as columns V<n>.  Blank lines are skipped.
+
+static std::vector<std::string>
+unquote_all (const std::vector<std::string>& names)
+{
+    std::vector<std::string> bare;
+    for (int iname = 0; iname < names.size(); iname++)
+    {
+	bare.push_back (unquote_value (names[iname]));
+    }
+    return bare;
+}
+
+// The first nfields fields of a header line as written, without quotes
+
+static std::vector<std::string> header_fields (const std::string& aline,
+					       int nfields)
+{
+    std::string first;
+    std::vector<std::string> fields;
+    aligncsv::split_row (aline.data(), aline.data() + aline.length(), first,
+			 fields);
+    fields.insert (fields.begin(), first);
+    fields.resize (nfields);
+    return unquote_all (fields);
+}
+
+// [[Rcpp::export]]
+Rcpp::List separate_header_file (SEXP file, bool remove_trailers = true,
+				 bool joined_names = false)
+{
+    std::string contents;
+    std::string filename = "raw vector";
+    if (TYPEOF (file) == RAWSXP) {
+	Rcpp::RawVector raw (file);
+	if (raw.size()) {
+	    contents.assign (reinterpret_cast<const char*>(&raw[0]),
+			     raw.size());
+	}
+    } else {
+	filename = Rcpp::as<std::string>(file);
+	std::ifstream infile (filename.c_str(), std::ios::binary);
+	if (!infile.is_open()) {
+	    Rcpp::stop ("No Such File: " + filename);
+	}
+	contents.assign (std::istreambuf_iterator<char>(infile),
+			 std::istreambuf_iterator<char>());
+    }
+    const char* next = contents.data();
+    const char* text_end = next + contents.size();
     std::string aline;
-    std::string field;
-    std::string last_field = "";
-    int count_empties;
-    int record_size;
-    bool header2_required;
-
-    std::vector<std::vector<std::string> > Lines_in_file;
-    for (int ifile = 0; ifile < ninfiles; ifile++) {
-        FileData.clear();
-        std::vector<std::string> header1;
-        std::vector<std::string> header2;
-        header2_required = false;
-        
-        std::cout << "\nReading file " << Filenames[ifile] << "\n";
-        
-        // Current design permits (but does not require) two headers
-        //   First header is incomplete if there are nulls so second is then read
-        //   Composite field names are constructed using both header values with
-        //   HEADER_SEPARATOR in between.  The first header value, if null, is
-        //   taken from the previously defined name.
-        
-        // CSV files created by Microsoft and similar programs are created with
-        //   a non-standard trailing
-        //   comma after the last non-null field (in effect, using comma as cell
-        //   terminator rather than cell separator).  This is allowed for but not
-        //   required (making this more complicated than I would like).
-        
-        //   read first header
-        
-        getline (infile[ifile], aline);
-        //    std::cout << "Got line1: " << aline << "\n";
-        
-        std::stringstream sstream1(aline);
-        count_empties = 0;
-        bool last_field_empty = false;
-        bool last_empty_field_counted = false;
-        while (std::getline (sstream1, field, ',')) {
-            last_field_empty = false;
-            last_empty_field_counted = false;
-            // printf ("Got name: %s\n",field.c_str());
-            if (field.empty()) {
-                count_empties++;
-                field = last_field;
-                last_field_empty = true;
-                last_empty_field_counted = true;
-            } else {
-                // handle non-standard line terminators as uncounted empty
-                bool empty_field = false;
-                int flen = field.length();
-                if (flen < 3) {
-                    empty_field = true;
-                    for (int fin = 0; fin < flen; fin++) {
-                        if (!std::isspace(field[fin])) {
-                            empty_field = false;
-                        }
-                    }
-                    if (empty_field) {
-                        // std::cout << "...virtually empty\n";
-                        field = last_field;
-                        last_field_empty = true;
-                    }
-                }
-            }
-            header1.push_back (field);
-        }
-        
-        if (last_field_empty) {
-            // std::cout << "last field empty so popping\n";
-            header1.pop_back();
-        }
-        if (last_empty_field_counted) {
-            count_empties--;
-        }
-        if (count_empties) {
-            header2_required = true;
-        }
-        
-        //   read second header if required
-        
-        if (header2_required) {
-            count_empties = 0;
-            getline (infile[ifile], aline);
-            // printf ("Got line2: %s\n",aline.c_str());
-            std::stringstream sstream2(aline);
-            last_field_empty = false;
-            last_empty_field_counted = false;
-            while (std::getline (sstream2, field, ',')) {
-                last_field_empty = false;
-                last_empty_field_counted = false;
-                // printf ("Got name: %s\n",field.c_str());
-                if (field.empty()) {
-                    // std::cerr << "empty field in second header, file " <<
-                    // Filenames[ifile];
-                    count_empties++;
-                    last_field_empty = true;
-                    last_empty_field_counted = true;
-                } else {
-                    // handle non-standard line terminators as uncounted empty
-                    bool empty_field = false;
-                    int flen = field.length();
-                    if (flen < 3) {
-                        empty_field = true;
-                        for (int fin = 0; fin < flen; fin++) {
-                            if (!std::isspace(field[fin])) {
-                                empty_field = false;
-                            }
-                        }
-                        if (empty_field) {
-                            // std::cout << "...virtually empty\n";
-                            field = last_field;
-                            last_field_empty = true;
-                        }
-                    }
-                }
-                header2.push_back (field);
-            }
-            if (last_field_empty) {
-                // std::cout << "last field empty so popping\n";
-                header2.pop_back();
-            }
-            if (last_empty_field_counted) {
-                count_empties--;
-            }
-            if (count_empties) {
-                std::cerr << "Second header has incomplete fields in file: "
-                << Filenames[ifile] << "\n";
-                return -2;
-            }
-            if (header2.size() != header1.size()) {
-                std::cerr << "First and second headers different size\n";
-                return -3;
-            }
-            record_size = header2.size();
-            std::cout << "Two headers read successfully.\n";
-        } else {
-            std::cout << "One header read successfully.\n";
-        }
-        
-        // Create composite field names from both headers
-        // Second header line becomes "suffix" (e.g. "@subject-1")
-        //   If second header field is blank, the preceding non-blank, if any, is used
-        // If quotes are present in either name, they apply to both but are removed
-        //   in between.
-        
-        std::vector<std::string> fields;
-        if (!header2_required) {
-            fields = header1;
-        } else {
-            std::string last_suffix = "";
-            for (int ich = 0; ich < record_size; ich++) {
-                bool quote_prefix = false;
-                bool quote_suffix = false;
-                std::string composite = header2[ich];
-                if ('"' == composite[composite.length()-1]) {
-                    composite.erase(composite.length()-1);
-                    quote_prefix = true;
-                }
-                
-                std::string suffix = header1[ich];
-                if (suffix.length() > 0) {
-                    last_suffix = suffix;
-                } else {
-                    if (last_suffix.length() > 0) {
-                        suffix = last_suffix;
-                    } else {
-                        suffix = "";
-                    }
-                }
-                if (suffix[0] == '"') {
-                    if (single_header) {
-                        suffix.erase(0,1);
-                    }
-                    quote_suffix = true;
-                }
-                if (suffix.length() > 0) {
-                    composite += HEADER_SEPARATOR;
-                    composite += suffix;
-                }
-                if (quote_prefix && composite[composite.length()-1] != '"') {
-                    composite += "\"";
-                }
-                if (quote_suffix && !quote_prefix) {
-                    composite = "\"" + composite;
-                }
-                fields.push_back (composite);
-                Header.push_back (composite);
-                if (ifile==0 || ich > 0) {
-                    Header1.push_back (suffix);
-                    Header2.push_back (header2[ich]);
-                }
-                DataColumns[ifile]++;
-            }
-        }
-        DataColumns[ifile]--;  // Remove peak column
-        
-        
-        // ORIGINAL VERSION did this:
-        // Read records into hashtable using composite names:
-        //   Each hastable entry is a string (field value) and the key
-        //     is <chemical_name>+<composite-field-name> because
-        //     the chemical name applies to each row and the field name applies to
-        //     the column within each row
-        
-        // REVISION 2 now does this:
-        //   Original design was assuming only one record per chemical.  But
-        //     a chemical may appear in multiple records in one file, and those
-        //     records are distinguished by different values in the first and/or
-        //     second retention time dimensions.  Joining is really understood as
-        //     alighning related records, which have the same chemical AND
-        //     similar first and second weight times.
-        
-        //   The new algorithm saves each LINE of fields by chemical name & sequential
-        //   index number.  Information is saved this way separately for each file.
-        //   and at the same time, a hash of chemical names is also created.
-        //
-        //   For output, we cycle through each chemical name.
-        //     For each file having that chemical, we get the first retention
-        //     time(s) available in records in that file (as an average for each
-        //     applicable record).  Starting from the lowest
-        //     retention time found in all files, we try to find matching lines in
-        //     other files within 10%.  Once we have set of matching lines from all
-        //     possible files, we start from the longest retention time in that
-        //     group, and see if it better matches the next higher retention time(s)
-        //     we would find, and thereby peel away the higher ones that that
-        //     have better matches above, until the current line matches best.
-        //
-        //   The same selection method is applied to the second retention times.
-        //     If the set of records found for second retention times is different,
-        //     a warning message is given.
-        //
-        //  The complete set of matching lines is written to the output file and
-        //     removed from the working set, and the algorithm continues until all
-        //     chemicals have been processed.
-        
-        //  Each field in line of each file is stored as a std::vector of std::string
-        //      (except the first chemical name field)
-        //  That is then stored in a unordered_map using file-index, chemical-name,
-        //    and record index number
-        //
-        
-        std::vector<std::string>* Fields;
-        
-        while (getline(infile[ifile], aline)) {
-            // std::cout << "Got line " << aline << "\n";
-            
-            // requires explicit parsing because there may be quoted fields
-            //   first, get first field, chemicalName
-            
-            std::vector<std::string> Fields;
-            
-            int column = 0;
-            std::string chemicalName;
-            
-            std::string::iterator it = aline.begin();
-            bool finis = false;
-            unsigned quotes = 0;
-            char prev = 0;
-            while (!finis && it != aline.end()) {
-                switch (*it) {
-                    case '"':
-                        ++quotes;
-                        break;
-                    case ',':
-                        if (quotes == 0 || (prev == '"' && (quotes & 1) == 0)) {
-                            finis = true;
-                        }
-                        break;
-                    default:;
-                }
-                if (!finis) {
-                    chemicalName += prev = *it;
-                }
-                it++;
-            }
-            Chemicals.insert (chemicalName);
-            
-            // next, get each field and add to table for this chemicalName and column
-            
-            std::string field;
-            std::string key;
-            while (1) {
-                finis = false;
-                quotes = 0;
-                field = "";
-                while (!finis && it != aline.end()) {
-                    bool cr = false;
-                    switch (*it) {
-                        case '"':
-                            ++quotes;
-                            break;
-                        case ',':
-                            if (quotes == 0 || (prev == '"' && (quotes & 1)==0)) {
-                                finis = true;
-                            }
-                            break;
-                        case '\r':
-                            cr = true;
-                            break;
-                        default:;
-                    }
-                    if (!finis && !cr) {
-                        field += prev = *it;
-                    }
-                    it++;
-                }
-                Fields.push_back(field);
-                column++;
-                if (it == aline.end()) {
-                    break;
-                }
-            }
-            ChemRecord chemrecord;
-            chemrecord.fields = Fields;
-            float stime = 0;
-            
-            // stof not supported in gcc 4.4.7
-            //        std::string::size_type sz;
-            //        stime = std::stof (Fields[1], &sz);
-            
-            // instead using strtof, and skip past quotes if used
-            const int bufsiz = 128;
-            char pstring[bufsiz];
-            strncpy (pstring,Fields[1].c_str(),bufsiz);
-            char* ppstring;
-            if (pstring[0] == '"') {
-                ppstring = &pstring[1];
-            } else {
-                ppstring = &pstring[0];
-            }
-            char* ppend;
-            stime = strtof (ppstring, &ppend);
-            if (stime==0 || (*ppend != '\0' && *ppend != '"')) {
-                std::cerr << "error reading time value: " << Fields[1] << "\n";
-                return -1;
-            }
-            chemrecord.time1 = stime;
-            if (FileData.count(chemicalName)) {
-                FileData[chemicalName].push_back(chemrecord);
-            } else {
-                std::vector<ChemRecord> crecords;
-                crecords.push_back(chemrecord);
-                FileData[chemicalName] = crecords;
-            }
-            
-        }
-        if (infile[ifile].bad()) {
-            std::cerr << "error reading file\n";
-            return -1;
-        }
-        AllFileData.push_back(FileData);
-    } // End reading all files
-    std::cout << "Finished reading all files\n";
-    
-    
-    // write the output headers
-    
-    if (single_header || !header2_required) {
-        for (int ifield = 0; ifield < Header1.size(); ifield++) {
-            if (ifield > 0) {
-                outfile << ",";
-            }
-            outfile << Header[ifield];
-        }
-        outfile << LineTerminator;
+
+    // read the header(s)
+
+    std::vector<std::string> header1;
+    std::vector<std::string> header2;
+    std::vector<std::string> names;
+    const char* line_end = std::find (next, text_end, '\n');
+    std::string line1 (next, line_end);
+    next = line_end + 1;
+    bool two_headers = aligncsv::read_header (line1, header1);
+    if (two_headers) {
+	line_end = std::find (std::min (next, text_end), text_end, '\n');
+	aline.assign (std::min (next, text_end), line_end);
+	next = line_end + 1;
+	if (aligncsv::read_header (aline, header2)) {
+	    Rcpp::stop ("Second header has incomplete fields in file: " +
+			filename);
+	}
+	if (header2.size() != header1.size()) {
+	    Rcpp::stop ("First and second headers different size");
+	}
+	aligncsv::composite_names (header1, header2, 1, names);
     } else {
-        std::string lastfield = "";
-        for (int ifield = 0; ifield < Header1.size(); ifield++) {
-            if (ifield > 0) {
-                outfile << ",";
-            }
-            if (Header1[ifield] != lastfield) {
-                outfile << Header1[ifield];
-            }
-            lastfield = Header1[ifield];
-        }
-        outfile << LineTerminator;
-        if (header2_required) {
-            for (int ifield = 0; ifield < Header2.size(); ifield++) {
-                if (ifield > 0) {
-                    outfile << ",";
-                }
-                outfile << Header2[ifield];
-            }
-            outfile << LineTerminator;
-        }
-    }
-    
-    //              WRITE OUTPUT DATA
-    
-    // iterate through each chemical seen
-    
-    int records_written = 0;
-    std::cout << "Number of chemicals found: " << Chemicals.size() << "\n";
-    for (std::set<std::string>::iterator
-         it = Chemicals.begin(); it != Chemicals.end(); ++it) {
-        std::string keychem = *it;
-        bool more_data_seen = true;
-        while (more_data_seen) {
-            std::string outline = keychem;
-            
-            // Obtain first and second lowest retention time records from all files
-            
-            std::vector<ChemRecord> lowest_recs;
-            float lowest_time1 = 0;
-            float second_lowest_time1 = 0;
-            
-            int ifile;
-            more_data_seen = false;
-            for (ifile = 0; ifile < ninfiles; ifile++) {
-                if (AllFileData[ifile].count(keychem) &&
-                    AllFileData[ifile][keychem].size()) {
-                    // sort in place (lowest to back)
-                    std::sort (AllFileData[ifile][keychem].begin(),
-                               AllFileData[ifile][keychem].end(),
-                               ChemRecord::higher);
-                    
-                    // pop the lowest
-                    ChemRecord lowest  = AllFileData[ifile][keychem].back();
-                    AllFileData[ifile][keychem].pop_back();
-                    if (lowest_time1 == 0 ||
-                        lowest_time1 > lowest.time1) {
-                        lowest_time1 = lowest.time1;
-                    }
-                    lowest_recs.push_back(lowest);
-                    
-                    // check the second lowest for time only (don't pop)
-                    
-                    if (AllFileData[ifile][keychem].begin() ==
-                        AllFileData[ifile][keychem].end()) {
-                    } else {
-                        more_data_seen = true;
-                        float test_lowest_time1 =
-                        AllFileData[ifile][keychem].back().time1;
-                        if (second_lowest_time1 == 0 ||
-                            second_lowest_time1 > test_lowest_time1) {
-                            second_lowest_time1 = test_lowest_time1;
-                        }
-                    }
-                } else {
-                    lowest_recs.push_back(NA);
-                }
-            }
-            
-            // Now, for each record in our lowest_recs set
-            //    See if it is higher that adiff above the lowest
-            //    See if it is closer to the second_lowest than lowest
-            //      If either condition applies, push it back
-            
-            //         std::cout << "aligning\n";
-            for (ifile = 0; ifile < ninfiles; ifile++) {
-                ChemRecord test_record = lowest_recs[ifile];
-                float cutoff;
-                if (afraction) {
-                    cutoff = (1 + adiff) * lowest_time1;
-                } else {
-                    cutoff = lowest_time1 + adiff;
-                }
-                bool pushback = false;
-                if (test_record.nfields() != 0) {
-                    if (test_record.time1 > cutoff) {
-                        pushback = true;
-                    } else if (test_record.time1 - lowest_time1 >
-                               ABS(second_lowest_time1 - test_record.time1))
-                    {
-                        pushback = true;
-                    }
-                    if (pushback) {
-                        //             std::cout << "doing pushback on record with time " <<
-                        //                 test_record.time1 << "\n";
-                        more_data_seen = true;
-                        AllFileData[ifile][keychem].push_back(test_record);
-                        lowest_recs[ifile] = NA;
-                    }
-                }
-            }
-            
-            // Accumulate all the lowest records that haven't been pushed back
-            // Write out blanks for records that don't exist or have been pushed back
-            
-            //         std::cout << "Accumulating\n";
-            for (ifile=0; ifile < ninfiles; ifile++) {
-                bool first_skipped = false;
-                if (lowest_recs[ifile].nfields()) {
-                    std::vector<std::string>::iterator field = 
-                    lowest_recs[ifile].fields.begin();
-                    std::string last_field;
-                    int column = 0;
-                    for (; field != lowest_recs[ifile].fields.end();field++) {
-                        // data records may have extra terminating comma (microsoft nonstandard csv)
-                        // only fields with names are valid
-                        if (++column > DataColumns[ifile]) {
-                            break;
-                        }
-                        
-                        outline += ",";
-                        outline += *field;
-                        last_field = *field;
-                    }
-                } else {
-                    // output empty fields for this file
-                    int column = 0;
-                    while (++column <= DataColumns[ifile]) {
-                        outline += ",";
-                    }
-                }
-            }
-            outline += LineTerminator;
-            OutputLines.push_back (OutputRecord(outline,lowest_time1));
-        }
-    }
-    
-    // Sort all output records by time1
-    
-    std::sort (OutputLines.begin(),OutputLines.end(),OutputRecord::lower);
-    
-    // Write all output records
-    
-    std::vector<OutputRecord>::iterator it;
-    for (it = OutputLines.begin(); it != OutputLines.end(); it++) {
-        outfile << it->line;
-        records_written++;
-    }
-    
-    std::cout << "\n" << records_written 
-    << " records written to aligncsv.csv\n\n";
-    return 0;
+	names = header1;
+    }
+    names = unquote_all (names);
+    header1 = unquote_all (header1);
+    header2 = unquote_all (header2);
+    if (joined_names) {
+	header1 = header_fields (line1, header1.size());
+	if (two_headers) {
+	    header2 = header_fields (aline, header2.size());
+	}
+	for (int icol = 0; icol < names.size(); icol++)
+	{
+	    if (!two_headers || header1[icol].empty()) {
+		names[icol] = two_headers ? header2[icol] : header1[icol];
+	    } else {
+		names[icol] = header1[icol] + "_" + header2[icol];
+	    }
+	}
+    }
+
+    // read the data rows into columns
+
+    std::vector<std::vector<std::string> > columns (names.size());
+    std::string chemical;
+    std::vector<std::string> fields;
+    int nrows = 0;
+    while (next < text_end)
+    {
+	line_end = std::find (next, text_end, '\n');
+	if (line_end == next || (line_end == next + 1 && *next == '\r')) {
+	    next = line_end + 1;
+	    continue;
+	}
+	aligncsv::split_row (next, line_end, chemical, fields);
+	next = line_end + 1;
+	fields.insert (fields.begin(), chemical);
+	int ncols = names.size();
+	if (!remove_trailers && fields.size() > ncols) {
+	    ncols = fields.size();
+	}
+	if (columns.size() < ncols) {
+	    columns.resize (ncols, std::vector<std::string>(nrows));
+	}
+	for (int icol = 0; icol < columns.size(); icol++)
+	{
+	    if (icol < fields.size()) {
+		columns[icol].push_back (unquote_value (fields[icol]));
+	    } else {
+		columns[icol].push_back ("");
+	    }
+	}
+	nrows++;
+    }
+    for (int icol = names.size(); icol < columns.size(); icol++)
+    {
+	std::ostringstream extra;
+	extra << "V" << icol + 1;
+	names.push_back (extra.str());
+    }
+
+    Rcpp::List data (names.size());
+    for (int icol = 0; icol < names.size(); icol++)
+    {
+	columns[icol].resize (nrows);
+	data[icol] = column_vector (columns[icol]);
+	std::vector<std::string>().swap (columns[icol]);
+    }
+    data.attr ("names") = Rcpp::wrap (names);
+    data.attr ("row.names") = Rcpp::IntegerVector::create (NA_INTEGER,
+							    -nrows);
+    data.attr ("class") = "data.frame";
+
+    Rcpp::List header = Rcpp::List::create
+	(Rcpp::Named ("header1") = Rcpp::wrap (header1),
+	 Rcpp::Named ("header2") = Rcpp::wrap (header2));
+    return Rcpp::List::create (Rcpp::Named ("header") = header,
+			       Rcpp::Named ("data") = data);
 }
 
+// [[Rcpp::export]]
+Rcpp::DataFrame align_frames (Rcpp::List inputs, double diff = 0.01,
+			      bool restricted = false,
+			      Rcpp::Nullable<Rcpp::NumericVector> time1_range = R_NilValue,
+			      Rcpp::Nullable<Rcpp::NumericVector> min_sn = R_NilValue,
+			      Rcpp::Nullable<Rcpp::NumericVector> min_area = R_NilValue,
+			      Rcpp::Nullable<Rcpp::CharacterVector> chemicals = R_NilValue,
+			      Rcpp::Nullable<Rcpp::CharacterVector> exclude_chemicals = R_NilValue,
+			      bool lazy_columns = true,
+			      Rcpp::Nullable<Rcpp::NumericVector> diff2 = R_NilValue)
+{
+    if (diff < 0) {
+	Rcpp::stop ("diff must be >= 0");
+    }
+    aligncsv::AlignOptions options;
+    options.single_header = 1;
+    options.restricted = restricted;
+    options.unquoted_chemicals = true;
+    if (diff2.isNotNull()) {
+	options.adiff2 = Rcpp::NumericVector (diff2.get())[0];
+	if (!(options.adiff2 >= 0)) {
+	    Rcpp::stop ("diff2 must be >= 0");
+	}
+    }
+    options.lazy = true;
+    if (time1_range.isNotNull()) {
+	Rcpp::NumericVector range (time1_range.get());
+	if (range.size() != 2 || range[1] < range[0]) {
+	    Rcpp::stop ("time1_range must be c(min, max) with min <= max");
+	}
+	options.Time1Filter = true;
+	options.MinTime1 = range[0];
+	options.MaxTime1 = range[1];
+    }
+    if (min_sn.isNotNull()) {
+	options.SNFilter = true;
+	options.MinSN = Rcpp::NumericVector (min_sn.get())[0];
+    }
+    if (min_area.isNotNull()) {
+	options.AreaFilter = true;
+	options.MinArea = Rcpp::NumericVector (min_area.get())[0];
+    }
+    if (chemicals.isNotNull()) {
+	Rcpp::CharacterVector names (chemicals.get());
+	for (int iname = 0; iname < names.size(); iname++)
+	{
+	    options.IncludeChemicals.insert (Rcpp::as<std::string>(names[iname]));
+	}
+	options.IncludeFilter = true;
+    }
+    if (exclude_chemicals.isNotNull()) {
+	Rcpp::CharacterVector names (exclude_chemicals.get());
+	for (int iname = 0; iname < names.size(); iname++)
+	{
+	    options.ExcludeChemicals.insert (Rcpp::as<std::string>(names[iname]));
+	}
+	options.ExcludeFilter = true;
+    }
+
+    // read and align, then make the data frame column by column
+
+#ifdef ALIGNCSV_ALTLIST
+    if (lazy_columns) {
+	return lazy_frame (inputs, diff, options);
+    }
+#endif
+    aligncsv::Aligner aligner (options);
+    read_inputs (inputs, aligner);
+    FrameSink sink;
+    aligner.align (diff, sink);
+    std::vector<std::string> names;
+    aligner.column_names (names);
+    sink.columns.resize (names.size());
+    int nrows = sink.columns[0].size();
+
+    Rcpp::List result (names.size());
+    for (int icol = 0; icol < names.size(); icol++)
+    {
+	sink.columns[icol].resize (nrows);
+	result[icol] = column_vector (sink.columns[icol]);
+	std::vector<std::string>().swap (sink.columns[icol]);
+    }
+    result.attr ("names") = Rcpp::wrap (names);
+    result.attr ("row.names") = Rcpp::IntegerVector::create (NA_INTEGER,
+							      -nrows);
+    result.attr ("class") = "data.frame";
+    return Rcpp::DataFrame (result);
+}
@@ -0,0 +1,279 @@
+// Filename: aligncsv_manifest.cc
+// Purpose: batch mode for aligncsv (--manifest)
+//
+// See aligncsv_manifest.h for the manifest format.
+//-
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "libaligncsv.h"
+#include "aligncsv_manifest.h"
+
+bool parse_job (const std::vector<std::string>& args, AlignJob& job,
+		std::string& error)
+{
+    for (int iarg = 0; iarg < args.size(); iarg++)
+    {
+	const std::string& arg = args[iarg];
+	if (arg == "-1") {
+	    job.options.single_header = 1;
+	} else if (arg == "-m") {
+	    job.options.LineTerminator = MICROSOFT_TERMINATOR;
+	} else if (arg == "-r") {
+	    job.options.restricted = true;
+	} else if (arg == "-d") {
+	    if (++iarg >= args.size()) {
+		error = "-d requires <diff> specification";
+		return false;
+	    }
+	    const char* pdiff = args[iarg].c_str();
+	    char* ppend;
+	    job.adiff = strtof (pdiff, &ppend);
+	    if (job.adiff < 0 || ppend == pdiff || *ppend != 0) {
+		error = "<diff> specification must be >= 0";
+		return false;
+	    }
+	} else if (arg == "--by-time") {
+	    job.options.by_time = true;
+	} else if (arg == "--by-class") {
+	    job.options.by_time = true;
+	    job.options.by_class = true;
+	} else if (arg == "--sequential-dp") {
+	    job.options.sequential_dp = true;
+	} else if (arg == "-d2") {
+	    if (++iarg >= args.size()) {
+		error = "-d2 requires <diff2> specification";
+		return false;
+	    }
+	    const char* pdiff = args[iarg].c_str();
+	    char* ppend;
+	    job.options.adiff2 = strtof (pdiff, &ppend);
+	    if (job.options.adiff2 < 0 || ppend == pdiff || *ppend != 0) {
+		error = "<diff2> specification must be >= 0";
+		return false;
+	    }
+	} else if (arg.length() > 1 && arg[0] == '-') {
+	    error = "unknown option " + arg;
+	    return false;
+	} else {
+	    job.filenames.push_back (arg);
+	}
+    }
+    if (job.filenames.empty()) {
+	error = "no files given";
+	return false;
+    }
+    if (job.options.sequential_dp && job.options.adiff2 >= 0) {
+	error = "--sequential-dp is not used with -d2";
+	return false;
+    }
+    return true;
+}
+
+// Split a manifest line into arguments (quotes removed)
+
+static void split_args (const std::string& line,
+			std::vector<std::string>& args)
+{
+    std::string::size_type pos = 0;
+    while (1) {
+	pos = line.find_first_not_of (" \t\r", pos);
+	if (pos == std::string::npos) {
+	    return;
+	}
+	std::string arg;
+	bool quoted = false;
+	for (; pos < line.length(); pos++)
+	{
+	    char c = line[pos];
+	    if (c == '"') {
+		quoted = !quoted;
+	    } else if (!quoted && (c == ' ' || c == '\t' || c == '\r')) {
+		break;
+	    } else {
+		arg += c;
+	    }
+	}
+	args.push_back (arg);
+    }
+}
+
+int aligncsv_manifest (const char* manifestname,
+		       const aligncsv::AlignOptions& options,
+		       const char* statsname)
+{
+    std::ifstream manifest (manifestname);
+    if (manifest.fail()) {
+	std::cerr << "No Such File: " << manifestname << "\n";
+	return -1;
+    }
+
+// Read the jobs, checking that each has its own new outfile
+
+    std::vector<AlignJob> jobs;
+    std::set<std::string> outnames;
+    std::string line;
+    int lineno = 0;
+    while (std::getline (manifest, line)) {
+	lineno++;
+	std::vector<std::string> args;
+	split_args (line, args);
+	if (args.empty() || args[0][0] == '#') {
+	    continue;
+	}
+	jobs.push_back (AlignJob());
+	AlignJob& job = jobs.back();
+	job.options = options;
+	job.outname = args[0];
+	args.erase (args.begin());
+	std::string error;
+	if (!parse_job (args, job, error)) {
+	    std::cerr << manifestname << " line " << lineno << ": " << error
+		      << "\n";
+	    return -1;
+	}
+	if (!outnames.insert (job.outname).second) {
+	    std::cerr << manifestname << " line " << lineno << ": "
+		      << job.outname << " is written by an earlier job\n";
+	    return -1;
+	}
+	if (FILE *testfile = fopen (job.outname.c_str(),"r")) {
+	    fclose (testfile);
+	    std::cerr << "file named " << job.outname <<
+		" already exists and must be deleted first\n";
+	    return -1;
+	}
+    }
+    if (jobs.empty()) {
+	std::cerr << "No jobs found in " << manifestname << "\n";
+	return -1;
+    }
+
+// Read each file named in any job once (with 2nd dimension times if any
+//   job aligns them)
+
+    aligncsv::AlignOptions read_options = options;
+    std::map<std::string,int> input_index;
+    std::vector<std::string> inputs;
+    for (int ijob = 0; ijob < jobs.size(); ijob++)
+    {
+	if (jobs[ijob].options.adiff2 >= 0) {
+	    read_options.adiff2 = jobs[ijob].options.adiff2;
+	}
+	for (int ifile = 0; ifile < jobs[ijob].filenames.size(); ifile++)
+	{
+	    const std::string& filename = jobs[ijob].filenames[ifile];
+	    if (input_index.find (filename) == input_index.end()) {
+		input_index[filename] = inputs.size();
+		inputs.push_back (filename);
+	    }
+	}
+    }
+    int ninputs = inputs.size();
+    std::vector<aligncsv::InputFilePtr> files (ninputs);
+    std::vector<std::string> errors (ninputs);
+    std::vector<int> statuses (ninputs, 0);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int iinput = 0; iinput < ninputs; iinput++)
+    {
+	std::ifstream infile (inputs[iinput].c_str());
+	if (infile.fail()) {
+	    errors[iinput] = "No Such File: " + inputs[iinput] + "\n";
+	    statuses[iinput] = -1;
+	    continue;
+	}
+	aligncsv::InputFile* file = new aligncsv::InputFile;
+	files[iinput] = aligncsv::InputFilePtr (file);
+	statuses[iinput] = file->read_stream (inputs[iinput], infile,
+					      read_options);
+	errors[iinput] = file->error;
+    }
+    for (int iinput = 0; iinput < ninputs; iinput++)
+    {
+	std::cout << "\nReading file " << inputs[iinput] << "\n";
+	if (statuses[iinput]) {
+	    std::cerr << errors[iinput];
+	    return statuses[iinput];
+	}
+	if (files[iinput]->two_headers) {
+	    std::cout << "Two headers read successfully.\n";
+	} else {
+	    std::cout << "One header read successfully.\n";
+	}
+    }
+    std::cout << "Finished reading all files\n";
+    aligncsv::Stats stats;
+    for (int iinput = 0; iinput < ninputs; iinput++)
+    {
+	stats.add (files[iinput]->stats);
+    }
+
+// Run the jobs, each writing its own outfile
+
+    int njobs = jobs.size();
+    std::vector<int> records_written (njobs, 0);
+    std::vector<aligncsv::Stats> jobstats (njobs);
+    errors.assign (njobs, "");
+    statuses.assign (njobs, 0);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int ijob = 0; ijob < njobs; ijob++)
+    {
+	const AlignJob& job = jobs[ijob];
+	aligncsv::Aligner aligner (job.options);
+	for (int ifile = 0; ifile < job.filenames.size(); ifile++)
+	{
+	    int iinput = input_index.find (job.filenames[ifile])->second;
+	    if (int status = aligner.add_file (files[iinput])) {
+		errors[ijob] = job.filenames[ifile] + ": " + aligner.error();
+		statuses[ijob] = status;
+		break;
+	    }
+	}
+	if (statuses[ijob]) {
+	    continue;
+	}
+	std::ofstream outfile (job.outname.c_str());
+	if (outfile.fail()) {
+	    errors[ijob] = "Unable to open output file " + job.outname + "\n";
+	    statuses[ijob] = -10;
+	    continue;
+	}
+	aligncsv::Stats* pstats = options.stats ? &jobstats[ijob] : 0;
+	aligncsv::CsvSink sink (outfile, job.options.LineTerminator);
+	aligner.align (job.adiff, sink, pstats);
+	records_written[ijob] = sink.rows_written();
+	if (pstats) {
+	    pstats->phases[aligncsv::WRITE_PHASE].bytes += sink.bytes_written();
+	}
+    }
+
+    int status = 0;
+    for (int ijob = 0; ijob < njobs; ijob++)
+    {
+	if (statuses[ijob]) {
+	    std::cerr << "\n" << errors[ijob];
+	    status = statuses[ijob];
+	} else {
+	    std::cout << "\n" << records_written[ijob]
+		      << " records written to " << jobs[ijob].outname << "\n";
+	}
+	stats.add (jobstats[ijob]);
+    }
+    std::cout << "\n";
+    if (options.stats && !status) {
+	status = report_stats (stats, statsname);
+    }
+    return status;
+}
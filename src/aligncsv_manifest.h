@@ -0,0 +1,60 @@
+// Filename: aligncsv_manifest.h
+// Purpose: batch mode for aligncsv (--manifest), and the alignment jobs
+//   it shares with --serve
+//
+// aligncsv --manifest <jobsfile> runs many alignments over subsets of the
+//   same files.  Each line of jobsfile is one job:
+//
+//     <outfile> [-1] [-d <diff>] [-d2 <diff2>] [-m] [-r] [--by-time]
+//               [--by-class] [--sequential-dp] <filename>+
+//
+//   Arguments are separated by spaces or tabs, and may be enclosed in
+//   double quotes (e.g. for names containing spaces).  Blank lines and
+//   lines beginning with # are ignored.  File names are relative to the
+//   current directory.  Reading options (-l and the record and chemical
+//   filters) are given on the command line and apply to every job; the
+//   options of a job above, -o and --memory are refused there.
+//
+// Every file named in the manifest is read once (several at a time when
+//   compiled with OpenMP), then the jobs are run in parallel, each
+//   writing its own outfile.  As with -o, no outfile may already exist.
+//   With --stats, the phases of all files and jobs are added together.
+//-
+
+#ifndef ALIGNCSV_MANIFEST_H
+#define ALIGNCSV_MANIFEST_H
+
+#include <string>
+#include <vector>
+
+#include "libaligncsv.h"
+
+// One alignment: a --manifest line or a --serve request
+class AlignJob {
+public:
+    AlignJob () {adiff = 0.01;}
+    std::string outname;
+    aligncsv::AlignOptions options;
+    float adiff;
+    std::vector<std::string> filenames;
+};
+
+// Set job from its arguments
+//   ([-1] [-d <diff>] [-d2 <diff2>] [-m] [-r] [--by-time] [--by-class]
+//   [--sequential-dp] <filename>+), starting from the reading options
+//   already in job.options
+//   returns false with error set if the arguments are not valid
+bool parse_job (const std::vector<std::string>& args, AlignJob& job,
+		std::string& error);
+
+// Run the jobs in manifestname, reading files with options
+//   returns 0, or a negative status after an error message
+int aligncsv_manifest (const char* manifestname,
+		       const aligncsv::AlignOptions& options,
+		       const char* statsname = 0);
+
+// Print the --stats report, and write it as JSON to statsname if given
+//   (defined in aligncsv_v4.cc)
+int report_stats (const aligncsv::Stats& stats, const char* statsname);
+
+#endif
@@ -0,0 +1,482 @@
+// Filename: aligncsv_serve.cc
+// Purpose: resident server mode for aligncsv (--serve and --connect)
+//
+// See aligncsv_serve.h for the request format.  This uses POSIX sockets,
+//   so unlike the rest of aligncsv it doesn't build on Windows.
+//-
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+
+#include "libaligncsv.h"
+#include "aligncsv_serve.h"
+#include "aligncsv_manifest.h"
+
+#define MAX_REQUEST 1048576  // bytes in one request
+#define CLIENT_TIMEOUT 10    // seconds a client may keep a read or write
+			     //   waiting
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+// Buffered output to a socket
+
+class SocketBuf : public std::streambuf {
+public:
+    SocketBuf (int sockfd) : fd(sockfd), failed(false)
+	{setp (buffer, buffer + sizeof buffer);}
+    ~SocketBuf () {flush_buffer();}
+protected:
+    int overflow (int c) {
+	if (flush_buffer()) {
+	    return EOF;
+	}
+	if (c != EOF) {
+	    *pptr() = c;
+	    pbump (1);
+	    return c;
+	}
+	return 0;
+    }
+    int sync () {return flush_buffer();}
+private:
+    int flush_buffer () {
+	const char* next = pbase();
+	while (!failed && next < pptr()) {
+	    ssize_t nwritten = write (fd, next, pptr() - next);
+	    if (nwritten < 0) {
+		if (errno != EINTR) {
+		    failed = true;   // e.g. the client has gone
+		}
+	    } else {
+		next += nwritten;
+	    }
+	}
+	setp (buffer, buffer + sizeof buffer);
+	return failed ? -1 : 0;
+    }
+    int fd;
+    bool failed;
+    char buffer[65536];
+};
+
+// Files already read, least recently used dropped first
+//   The files of the request being handled are pinned, so that reading one
+//   of them doesn't drop another: each file got is pinned until unpin().
+
+class FileCache {
+public:
+    FileCache (const aligncsv::AlignOptions& options, size_t max_bytes)
+	: Options(options), Bytes(0), PinnedBytes(0), MaxBytes(max_bytes) {
+	Options.adiff2 = 0;  // any request may use -d2, so read time2
+    }
+
+// Get a file, reading it unless cached and unchanged
+//   returns 0 with error set if the file can't be read
+    aligncsv::InputFilePtr get (const std::string& filename,
+				std::string& error);
+    void unpin ();
+private:
+    class Entry {
+    public:
+	aligncsv::InputFilePtr file;
+	off_t size;
+	struct timespec mtime;
+	ino_t inode;
+	size_t bytes;
+	bool pinned;
+	std::list<std::string>::iterator use;
+    };
+    void pin (Entry& entry);
+    void drop (std::map<std::string,Entry>::iterator entry);
+
+    aligncsv::AlignOptions Options;
+    std::map<std::string,Entry> Entries;
+    std::list<std::string> Uses;  // most recently used first
+    size_t Bytes;
+    size_t PinnedBytes;
+    size_t MaxBytes;
+};
+
+void FileCache::pin (Entry& entry)
+{
+    if (!entry.pinned) {
+	entry.pinned = true;
+	PinnedBytes += entry.bytes;
+    }
+}
+
+void FileCache::unpin ()
+{
+    std::map<std::string,Entry>::iterator entry;
+    for (entry = Entries.begin(); entry != Entries.end(); ++entry)
+    {
+	entry->second.pinned = false;
+    }
+    PinnedBytes = 0;
+}
+
+void FileCache::drop (std::map<std::string,Entry>::iterator entry)
+{
+    Bytes -= entry->second.bytes;
+    if (entry->second.pinned) {
+	PinnedBytes -= entry->second.bytes;
+    }
+    Uses.erase (entry->second.use);
+    Entries.erase (entry);
+}
+
+aligncsv::InputFilePtr FileCache::get (const std::string& filename,
+				       std::string& error)
+{
+    struct stat status;
+    if (stat (filename.c_str(), &status)) {
+	error = "No Such File: " + filename + "\n";
+	return aligncsv::InputFilePtr();
+    }
+    std::map<std::string,Entry>::iterator entry = Entries.find (filename);
+    if (entry != Entries.end()) {
+	Entry& cached = entry->second;
+	if (cached.size == status.st_size &&
+	    cached.mtime.tv_sec == status.st_mtim.tv_sec &&
+	    cached.mtime.tv_nsec == status.st_mtim.tv_nsec &&
+	    cached.inode == status.st_ino) {
+	    Uses.splice (Uses.begin(), Uses, cached.use);
+	    pin (cached);
+	    std::cout << "Using cached file " << filename << "\n";
+	    return cached.file;
+	}
+	drop (entry);  // changed since read
+    }
+
+    std::cout << "Reading file " << filename << "\n";
+    std::ifstream infile (filename.c_str());
+    if (infile.fail()) {
+	error = "No Such File: " + filename + "\n";
+	return aligncsv::InputFilePtr();
+    }
+    aligncsv::InputFile* file = new aligncsv::InputFile;
+    aligncsv::InputFilePtr pfile (file);
+    if (file->read_stream (filename, infile, Options)) {
+	error = filename + ": " + file->error;
+	return aligncsv::InputFilePtr();
+    }
+
+// Make room, dropping the least recently used files.  Those are never
+//   pinned, as each pinned file was moved to the front when it was got.  A
+//   file too large to keep beside the pinned ones is used but not kept.
+
+    size_t bytes = file->memory_used();
+    if (PinnedBytes + bytes > MaxBytes) {
+	return pfile;
+    }
+    while (Bytes + bytes > MaxBytes) {
+	std::cout << "Dropping cached file " << Uses.back() << "\n";
+	drop (Entries.find (Uses.back()));
+    }
+    Uses.push_front (filename);
+    Entry& cached = Entries[filename];
+    cached.file = pfile;
+    cached.size = status.st_size;
+    cached.mtime = status.st_mtim;
+    cached.inode = status.st_ino;
+    cached.bytes = bytes;
+    cached.pinned = false;
+    cached.use = Uses.begin();
+    Bytes += bytes;
+    pin (cached);
+    return pfile;
+}
+
+// Read one request, returning its arguments (false if incomplete)
+
+static bool read_request (int fd, std::vector<std::string>& args)
+{
+    std::string request;
+    char buffer[4096];
+    while (request.length() < MAX_REQUEST) {
+	ssize_t nread = read (fd, buffer, sizeof buffer);
+	if (nread < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (nread <= 0) {
+	    return false;
+	}
+	request.append (buffer, nread);
+	std::string::size_type end = request.find ("\n\n");
+	if (end == std::string::npos && request == "\n") {
+	    end = 0;
+	}
+	if (end != std::string::npos) {
+	    std::istringstream lines (request.substr (0, end + 1));
+	    std::string line;
+	    while (std::getline (lines, line)) {
+		if (!line.empty()) {
+		    args.push_back (line);
+		}
+	    }
+	    return true;
+	}
+    }
+    return false;
+}
+
+static void reply_error (int fd, const std::string& message)
+{
+    SocketBuf buf (fd);
+    std::ostream out (&buf);
+    out << "ERROR: " << message;
+    if (message.empty() || message[message.length()-1] != '\n') {
+	out << "\n";
+    }
+}
+
+// Align the files of one request and send the output
+
+static void handle_request (int fd, FileCache& cache,
+			    const aligncsv::AlignOptions& server_options)
+{
+    std::vector<std::string> args;
+    if (!read_request (fd, args)) {
+	reply_error (fd, "incomplete request");
+	return;
+    }
+    AlignJob job;
+    job.options = server_options;
+    std::string error;
+    if (!parse_job (args, job, error)) {
+	reply_error (fd, error);
+	return;
+    }
+    const std::vector<std::string>& filenames = job.filenames;
+
+    aligncsv::Aligner aligner (job.options);
+    for (int ifile = 0; ifile < filenames.size(); ifile++)
+    {
+	aligncsv::InputFilePtr file = cache.get (filenames[ifile], error);
+	if (!file) {
+	    reply_error (fd, error);
+	    return;
+	}
+	if (aligner.add_file (file)) {
+	    reply_error (fd, filenames[ifile] + ": " + aligner.error());
+	    return;
+	}
+    }
+
+    std::vector<aligncsv::AlignedRow> rows;
+    aligner.align_rows (job.adiff, rows);
+    std::cout << rows.size() << " records aligned for " << filenames.size()
+	      << " files\n";
+
+    SocketBuf buf (fd);
+    std::ostream out (&buf);
+    out << "OK " << rows.size() << "\n";
+    std::vector<std::string> lines;
+    aligner.header_lines (lines);
+    for (int iline = 0; iline < lines.size(); iline++)
+    {
+	out << lines[iline];
+    }
+    aligncsv::CsvSink sink (out, job.options.LineTerminator);
+    for (int irow = 0; irow < rows.size(); irow++)
+    {
+	sink.row (aligner, rows[irow]);
+    }
+    out.flush();
+}
+
+static volatile sig_atomic_t Stopping = 0;
+
+static void stop_serving (int)
+{
+    Stopping = 1;
+}
+
+static bool socket_address (const char* socketname, struct sockaddr_un& addr)
+{
+    if (strlen (socketname) >= sizeof addr.sun_path) {
+	std::cerr << "socket name is too long: " << socketname << "\n";
+	return false;
+    }
+    memset (&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, socketname);
+    return true;
+}
+
+int aligncsv_serve (const char* socketname,
+		    const aligncsv::AlignOptions& options, size_t cache_bytes)
+{
+    struct sockaddr_un addr;
+    if (!socket_address (socketname, addr)) {
+	return -1;
+    }
+    int listenfd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (listenfd < 0) {
+	std::cerr << "Unable to create socket: " << strerror (errno) << "\n";
+	return -1;
+    }
+
+// A socket left by a server that has stopped is removed, but not one that
+//   a server is still listening on
+
+    struct stat status;
+    if (!stat (socketname, &status) && S_ISSOCK (status.st_mode)) {
+	if (!connect (listenfd, (struct sockaddr*) &addr, sizeof addr)) {
+	    std::cerr << "A server is already listening on " << socketname
+		      << "\n";
+	    close (listenfd);
+	    return -1;
+	}
+	close (listenfd);
+	unlink (socketname);
+	listenfd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (listenfd < 0) {
+	    std::cerr << "Unable to create socket: " << strerror (errno)
+		      << "\n";
+	    return -1;
+	}
+    }
+    if (bind (listenfd, (struct sockaddr*) &addr, sizeof addr) ||
+	listen (listenfd, 16)) {
+	std::cerr << "Unable to listen on " << socketname << ": "
+		  << strerror (errno) << "\n";
+	close (listenfd);
+	return -1;
+    }
+
+// A client going away must not stop the server, and SIGINT or SIGTERM
+//   interrupt accept so that the socket is removed
+
+    signal (SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    memset (&action, 0, sizeof action);
+    action.sa_handler = stop_serving;
+    sigemptyset (&action.sa_mask);
+    sigaction (SIGINT, &action, 0);
+    sigaction (SIGTERM, &action, 0);
+
+    std::cout << "Serving on " << socketname << "\n" << std::flush;
+    FileCache cache (options, cache_bytes);
+    int status_code = 0;
+    while (!Stopping) {
+	int fd = accept (listenfd, 0, 0);
+	if (fd < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED) {
+		continue;
+	    }
+	    std::cerr << "Unable to accept connection: " << strerror (errno)
+		      << "\n";
+	    status_code = -1;
+	    break;
+	}
+	struct timeval timeout;
+	timeout.tv_sec = CLIENT_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+	handle_request (fd, cache, options);
+	cache.unpin();
+	close (fd);
+	std::cout << std::flush;
+    }
+    close (listenfd);
+    unlink (socketname);
+    std::cout << "Stopped serving on " << socketname << "\n";
+    return status_code;
+}
+
+int aligncsv_request (const char* socketname,
+		      const std::vector<std::string>& args, std::ostream& out,
+		      int& rows, std::string& error)
+{
+    struct sockaddr_un addr;
+    if (strlen (socketname) >= sizeof addr.sun_path) {
+	error = std::string ("socket name is too long: ") + socketname + "\n";
+	return -1;
+    }
+    socket_address (socketname, addr);
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect (fd, (struct sockaddr*) &addr, sizeof addr)) {
+	error = std::string ("Unable to connect to ") + socketname + ": " +
+	    strerror (errno) + "\n";
+	if (fd >= 0) {
+	    close (fd);
+	}
+	return -1;
+    }
+    signal (SIGPIPE, SIG_IGN);
+
+    std::string request;
+    for (int iarg = 0; iarg < args.size(); iarg++)
+    {
+	request += args[iarg] + "\n";
+    }
+    request += "\n";
+    {
+	SocketBuf buf (fd);
+	std::ostream requests (&buf);
+	requests << request << std::flush;
+	if (!requests) {
+	    error = "Unable to send request\n";
+	    close (fd);
+	    return -1;
+	}
+    }
+
+// The first line of the reply is the status, the rest is the output
+
+    std::string reply;
+    char buffer[65536];
+    bool status_read = false;
+    while (1) {
+	ssize_t nread = read (fd, buffer, sizeof buffer);
+	if (nread < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (nread <= 0) {
+	    break;
+	}
+	if (status_read) {
+	    out.write (buffer, nread);
+	    continue;
+	}
+	reply.append (buffer, nread);
+	std::string::size_type eol = reply.find ('\n');
+	if (eol != std::string::npos) {
+	    status_read = true;
+	    if (reply.compare (0, 3, "OK ")) {
+		error = reply.substr (0, eol + 1);
+		close (fd);
+		return -2;
+	    }
+	    rows = atoi (reply.c_str() + 3);
+	    out.write (reply.data() + eol + 1, reply.length() - eol - 1);
+	}
+    }
+    close (fd);
+    if (!status_read) {
+	error = "No reply from server\n";
+	return -1;
+    }
+    return 0;
+}
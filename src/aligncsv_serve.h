@@ -0,0 +1,56 @@
+// Filename: aligncsv_serve.h
+// Purpose: resident server mode for aligncsv (--serve and --connect)
+//
+// aligncsv --serve <socket> listens on a Unix domain socket and keeps the
+//   files it has read in memory, so that repeated alignments of the same
+//   files don't read them again.  A cached file is read again if its size,
+//   modification time (to the nanosecond, where the file system keeps it)
+//   or inode has changed.  The least recently used files are dropped when
+//   the cache would exceed its limit (--cache-mb), but never a file of the
+//   request being handled.
+//
+// Requests are handled one at a time, and a client that leaves the server
+//   waiting 10 seconds to read from or write to it is dropped.  A request
+//   is the arguments of an alignment, one per line, ending with an empty
+//   line:
+//
+//     [-1] [-d <diff>] [-d2 <diff2>] [-m] [-r] [--by-time] [--by-class]
+//     [--sequential-dp] <filename>+
+//
+//   File names should be absolute, or they are relative to the directory
+//   the server was started in.  Reading options (-l and the record and
+//   chemical filters) are given when starting the server and apply to
+//   every request; the options of a request above, -o and --memory are
+//   refused there.
+//
+// The reply is a line "OK <rows>" followed by the aligned csv output (the
+//   header lines and <rows> rows), or a line "ERROR: <message>".  The
+//   server closes the connection after each reply.
+//
+// aligncsv --connect <socket> sends a request and writes the reply to the
+//   output file as aligncsv normally would.
+//-
+
+#ifndef ALIGNCSV_SERVE_H
+#define ALIGNCSV_SERVE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "libaligncsv.h"
+
+// Serve requests on socketname until interrupted (SIGINT or SIGTERM),
+//   caching up to cache_bytes of files read with options
+//   returns 0, or a negative status after an error message
+int aligncsv_serve (const char* socketname,
+		    const aligncsv::AlignOptions& options, size_t cache_bytes);
+
+// Send a request (see above) to a server and write the csv output to out
+//   returns 0 with rows set, or a negative status with error set
+int aligncsv_request (const char* socketname,
+		      const std::vector<std::string>& args, std::ostream& out,
+		      int& rows, std::string& error);
+
+#endif
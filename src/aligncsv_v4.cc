@@ -1,16 +1,129 @@
 // Filename: aligncsv.cc
 // Purpose: align multiple csv files produced by Chromatof
 // Author: Charles Peterson, Texas Biomed, August 2017
-// Usage: aligncsv [-1] [-d <diff>] [-o <outfile>] [-m] [<filename>]+
+// Usage: aligncsv [-1] [-d <diff>] [-d2 <diff2>] [-o <outfile>] [-m] [-r]
+//                 [-l] [--by-time] [--by-class] [--sequential-dp]
+//                 [--time1-range <min>:<max>] [--min-sn <sn>]
+//                 [--min-area <area>] [--chemicals <listfile>]
+//                 [--exclude-chemicals <listfile>] [--stats]
+//                 [--stats-json <jsonfile>] [--perf-counters] [--memory]
+//                 [--memory-project <nfiles>] [--trace <tracefile>]
+//                 [--report-chemicals <n>] [<filename>]+
+//        aligncsv --serve <socket> [--cache-mb <mb>] [-l] [filters]
+//        aligncsv --connect <socket> [-1] [-d <diff>] [-d2 <diff2>]
+//                 [-o <outfile>] [-m] [-r] [--by-time] [--by-class]
+//                 [--sequential-dp] [<filename>]+
+//        aligncsv --manifest <jobsfile> [-l] [filters] [--stats]
+//                 [--stats-json <jsonfile>] [--perf-counters]
+//                 [--trace <tracefile>]
 //        -1 means force one line header on output (not required if
 //           there is only one header anyway)
 //        -d <diff> is floating point fraction < 1 (proportion) or integer
 //           (arithmetic difference) by which 1st dimension time can vary in
 //           the same record (defaults to 0.01 meaning 1%), only first time
-//           in any record is checked
+//           in any record is checked.  Several comma separated values
+//           (e.g. -d 0.005,0.01,5) align the same input once for each,
+//           writing <outfile> with _d<diff> added before the extension
+//        -d2 <diff2> also align on the 2nd dimension time (the column after
+//           the 1st), which may vary by diff2 either way (a fraction < 1
+//           or a difference, as for <diff>).  Each row starts from the
+//           lowest 1st dimension time left, and takes from each other
+//           file the nearest record within both tolerances, so that
+//           co-eluting peaks with different 2nd dimension times aren't
+//           paired.  Records with no 2nd dimension time are matched on
+//           the 1st alone.  A grid over both times is used to find the
+//           nearest record, so the time taken grows with the number of
+//           records, not the number of pairs.
 //        -o <outfile> write to this file instead of aligncsv.csv
 //        -m Use "microsoft" excel formatting with trailing comma
 //        -r Restrict output to chemical and time found in all files
+//        -l Lazy fields: keep each data row unsplit in memory and split it
+//           into fields only when it is written (rows rejected by -r are
+//           never split)
+//        --by-time align records by time regardless of chemical name, so
+//           that unnamed peaks, and peaks given different names in
+//           different files, are aligned too.  All records are aligned
+//           as if they were one chemical, and each row is named by the
+//           chemical of its lowest time record.  The files' records are
+//           sorted once and aligned in one pass up the times, so the time
+//           taken grows as n log n in the number of records.
+//        --by-class like --by-time, but only aligning records with the same
+//           Class (the column before the 1st dimension time)
+//        --sequential-dp match each chemical's records file by file, in
+//           the order the files are given, finding for each file the
+//           matching with the rows made from the files before it that
+//           aligns the most records, and then has the least total
+//           difference from the rows' mean times (a record only joins a
+//           row if all its times stay within <diff> of the lowest, and
+//           records stay in time order).  Unlike the usual rule, which
+//           works up from the lowest times, an early choice can't force
+//           later records of a crowded chemical into the wrong rows.
+//           The matching is only optimal for each file against the rows
+//           before it: two files are aligned optimally, but with more
+//           the rows are not always the best over all files at once, and
+//           may change if the files are given in another order.  Uses a
+//           banded dynamic program, so the time taken grows with the
+//           number of records within <diff> of each other, not with the
+//           square of the records.  Not used with -d2.
+//        --time1-range <min>:<max> only read records with 1st dimension
+//           time from min to max
+//        --min-sn <sn> only read records with S/N of at least sn
+//        --min-area <area> only read records with Area of at least area
+//           (records failing these filters are dropped as files are read,
+//           and are never stored, aligned or written; like the time, only
+//           the first S/N and Area columns in a record are checked)
+//        --chemicals <listfile> only read records for the chemicals named
+//           in listfile, one per line (quotes optional)
+//        --exclude-chemicals <listfile> skip records for the chemicals named
+//           in listfile (rows skipped by either list are not tokenized
+//           past the chemical name)
+//        --stats print the wall and cpu time, bytes and records of each
+//           phase (open, header parse, row tokenize, time parse,
+//           alignment, output sort, output write) and the number of
+//           records pushed back while aligning.  Times for several files
+//           or <diff> values are added together.  The tokenizer's cpu
+//           kernel (scalar, sse2, avx2 or avx512, the best this processor
+//           has unless the environment variable ALIGNCSV_KERNEL names a
+//           narrower one) is also shown.
+//        --stats-json <jsonfile> also write the statistics to jsonfile
+//        --perf-counters also count cpu cycles, instructions, cache misses,
+//           branch misses and page faults in each phase (implies --stats),
+//           reporting instructions per cycle and misses per record, and
+//           the reading phases of each file.  Uses perf_event_open, so
+//           only on Linux; counters that can't be opened (e.g. in a
+//           virtual machine, or when perf_event_paranoid is too high)
+//           are shown as n/a, and the times are reported as usual.
+//        --memory print the memory held by each kind of data (record index,
+//           records, field strings, row text, headers, chemical set and
+//           aligned rows) after reading and after aligning, with the
+//           current and peak resident memory of the process
+//        --memory-project <nfiles> also estimate the memory needed to
+//           align nfiles similar files (implies --memory)
+//        --trace <tracefile> write a timeline of the run to tracefile as
+//           Chrome trace events, to be opened in chrome://tracing or
+//           ui.perfetto.dev.  There are spans for opening the files,
+//           reading and parsing each file, aligning each batch of
+//           chemicals (any chemical taking 1ms or more has its own span),
+//           sorting, writing and flushing each output file, each on the
+//           track of the thread doing it.  Without --trace nothing is
+//           timed.
+//        --report-chemicals <n> print the n chemicals taking the most
+//           alignment time, with the number of passes of the pop and
+//           pushback loop, the records pushed back, and the records in
+//           each file.  Times for several <diff> values are added
+//           together.
+//        --serve <socket> run as a server on a Unix domain socket, keeping
+//           files in memory between requests (see aligncsv_serve.h).  The
+//           -l and filter options apply to all requests.
+//        --cache-mb <mb> limit the files kept by --serve to about mb
+//           megabytes (default 1024)
+//        --connect <socket> have the server listening on socket align the
+//           files (reusing them if it has already read them), and write
+//           its output here as usual
+//        --manifest <jobsfile> run the alignment jobs listed in jobsfile,
+//           one per line, reading each file they use only once (see
+//           aligncsv_manifest.h).  The -l and filter options apply to all
+//           jobs.
 //
 // Output: aligncsv.csv file is written to working directory.
 //  
@@ -49,19 +162,19 @@
 //   the required conversion.
 //
 // Double quoted fields are written double quoted to the output file as well.
+//
+// Compile: the reading and alignment are done by libaligncsv (see
+//   libaligncsv.h), so build with it and the files for the other modes
+//   (all on one line), e.g.
+//     g++ -O2 -fopenmp -o aligncsv aligncsv_v4.cc aligncsv_serve.cc
+//         aligncsv_manifest.cc libaligncsv.cc
+//   or use the Makefile at the top of the tree (make builds
+//   build/aligncsv, make release a profile-guided build/release/aligncsv)
 //-
 
 
 #define MAXFILES 1000         // may be increased to system limits
-#define HEADER_SEPARATOR "@"  // this must not be used in column names
-#define UNIX_TERMINATOR "\n"
-
-// #define MICROSOFT_TERMINATOR ",\r\n"
-// this doesn't work.  standard library elides \r on linux systems
-// and adds it on Windows systems
-
-#define MICROSOFT_TERMINATOR ",\n"
-
+#define MAXDIFFS 100          // number of <diff> values in one run
 
 #include <string.h>
 #include <stdlib.h>
@@ -71,83 +184,119 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
-#include <sstream>
-#include <set>
-#include <cctype>
-#include <algorithm>
-#include <cmath>
-
-// STDPRE defines the prefix needed to get C++11 functionality
-// TR1 is needed if compiler is pre C++11 (e.g. gcc 4.4.7)
-// Comment this out for C++11 compliant compilers
-// tr1 update might be required for unordered_map
-
-//#define TR1 1
-
-#ifdef TR1
-#define STDPRE std::tr1
-#include <tr1/unordered_map>
-#else
-#define STDPRE std
-#include <unordered_map>
-#endif
+#include <iomanip>
 
-using std::ofstream;
+#include "libaligncsv.h"
+#include "aligncsv_serve.h"
+#include "aligncsv_manifest.h"
 
-STDPRE::unordered_map<std::string, std::string>Table;  // all field data
-std::set<std::string>Chemicals; // just the chemical names
-std::vector<std::string> Header;
-std::vector<std::string> Header1;
-std::vector<std::string> Header2;
 std::vector<std::string> Filenames;
-std::vector<int> DataColumns;
 
-// A single input record
-class ChemRecord {
-public:
-    std::vector<std::string> fields;  // data fields following chemical
-    float time1;
-    float time2;
-    static bool higher (ChemRecord c1, ChemRecord c2) 
-	{return c1.time1 > c2.time1;}
-    int nfields () {return fields.size();}
-};
+// argv ends with a null pointer, so this is safe after the last argument
+
+static bool arg_is (const char* arg, const char* option)
+{
+    return arg && !strcmp (arg, option);
+}
 
-ChemRecord NA;
 
-// All the records in one file
-STDPRE::unordered_map<std::string,std::vector<ChemRecord> > FileData;
+// Print the --stats report, and write it to statsname if given
+
+int report_stats (const aligncsv::Stats& stats, const char* statsname)
+{
+    std::cout << "Phase statistics (" << aligncsv::cpu_kernel_name
+	(aligncsv::cpu_kernel()) << " tokenizer):\n";
+    stats.print (std::cout);
+    std::cout << "\n";
+    if (statsname) {
+	std::ofstream statsfile (statsname);
+	stats.write_json (statsfile);
+	statsfile.close();
+	if (statsfile.fail()) {
+	    std::cerr << "Unable to write statistics to " << statsname << "\n";
+	    return -10;
+	}
+    }
+    return 0;
+}
 
-// All the records in all the files
-std::vector<STDPRE::unordered_map<std::string,std::vector<ChemRecord> > >AllFileData;
 
-// A single output line (including data from all files)
-class OutputRecord {
-public:
-    OutputRecord (std::string inputline, float intime1)
-	{line=inputline;time1=intime1;}
-    std::string line;
-    float time1;
-    static bool lower (OutputRecord r1, OutputRecord r2)
-	{return r1.time1 < r2.time1;}
-};
+// Print a --memory breakdown with the resident memory.  For a projection,
+//   the resident memory is estimated from the memory outside the counted
+//   data, which is assumed to stay the same.
 
-std::vector<OutputRecord> OutputLines;
+void report_memory (const aligncsv::MemoryUsage& usage,
+		    const aligncsv::MemoryUsage& measured)
+{
+    usage.print (std::cout);
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(2);
+    size_t current;
+    size_t peak;
+    aligncsv::resident_memory (current, peak);
+    if (&usage != &measured) {
+	if (peak) {
+	    double other = (double) peak - measured.total();
+	    std::cout << "  estimated peak resident memory "
+		      << (other + usage.total()) / 1048576 << " MB\n";
+	}
+    } else if (peak) {
+	std::cout << "  resident memory " << current / 1048576.0
+		  << " MB (peak " << peak / 1048576.0 << " MB)\n";
+    }
+    std::cout.flags (flags);
+    std::cout.precision (precision);
+}
 
+void report_memory (const aligncsv::MemoryUsage& usage)
+{
+    report_memory (usage, usage);
+}
+
+
+// Write the --trace timeline, if wanted
+
+int write_trace (const aligncsv::Trace& trace, const char* tracename)
+{
+    if (!tracename) {
+	return 0;
+    }
+    std::ofstream tracefile (tracename);
+    trace.write (tracefile);
+    tracefile.close();
+    if (tracefile.fail()) {
+	std::cerr << "Unable to write trace to " << tracename << "\n";
+	return -10;
+    }
+    std::cout << trace.nspans() << " trace spans written to " << tracename
+	      << "\n";
+    return 0;
+}
 
 
 // **** MAIN PROGRAM BEGINS HERE //
 
 int main (int argc, char** argv)
 {
-    std::string LineTerminator = UNIX_TERMINATOR;
-    float adiff = 0.01;
-    bool afraction = true;
+    std::vector<float> adiffs;
+    std::vector<std::string> difftexts;
+    std::string diff2text;
     std::ifstream infile[MAXFILES];  // std::vector not possible for ifstream
     int ninfiles = 0;
     std::string outname = "aligncsv.csv";
-    int single_header = 0;
-    bool restricted = false;
+    bool outname_given = false;
+    const char* servename = 0;
+    const char* connectname = 0;
+    const char* manifestname = 0;
+    const char* statsname = 0;
+    const char* tracename = 0;
+    aligncsv::Trace trace;
+    bool memory = false;
+    int project_files = 0;
+    int report_chemicals = 0;
+    size_t cache_mb = 1024;
+    aligncsv::AlignOptions options;
 
 // parse arguments and open files
 
@@ -156,9 +305,32 @@ int main (int argc, char** argv)
 	std::cout << "-1 means force two headers to one\n";
 	std::cout << "-d <diff> sets maximum alignment difference, default is .01 for 1%\n";
 	std::cout << "   >1 will set integer difference, 0 means must be exactly same\n";
+	std::cout << "   several comma separated values write one output file for each\n";
+	std::cout << "-d2 <diff2> also align on 2nd dimension time within diff2\n";
 	std::cout << "-o <outfile> means output to this file (default is aligncsv.csv)\n";
 	std::cout << "-m meaus use trailing comma format like Microsoft does\n";
 	std::cout << "-r means restrict to chemical/times found in all files\n";
+	std::cout << "-l means lazy, split row fields only when written\n";
+	std::cout << "--by-time align records by time regardless of chemical name\n";
+	std::cout << "--by-class align records by time within each Class\n";
+	std::cout << "--sequential-dp match each file with the rows of the files before it\n";
+	std::cout << "   (optimal for each such pair only, so results depend on file order)\n";
+	std::cout << "--time1-range <min>:<max> only read records with 1st dimension time in range\n";
+	std::cout << "--min-sn <sn> only read records with S/N at least sn\n";
+	std::cout << "--min-area <area> only read records with Area at least area\n";
+	std::cout << "--chemicals <listfile> only read chemicals named in listfile\n";
+	std::cout << "--exclude-chemicals <listfile> skip chemicals named in listfile\n";
+	std::cout << "--serve <socket> run as a server keeping files in memory\n";
+	std::cout << "--cache-mb <mb> memory for files kept by server (default 1024)\n";
+	std::cout << "--connect <socket> have server align files and write output here\n";
+	std::cout << "--manifest <jobsfile> run the alignment jobs in jobsfile\n";
+	std::cout << "--stats print time, bytes and records of each phase\n";
+	std::cout << "--stats-json <jsonfile> also write statistics to jsonfile\n";
+	std::cout << "--perf-counters also count cpu events in each phase\n";
+	std::cout << "--memory print memory used by each kind of data\n";
+	std::cout << "--memory-project <nfiles> also estimate memory for nfiles files\n";
+	std::cout << "--trace <tracefile> write a timeline of the run as Chrome trace events\n";
+	std::cout << "--report-chemicals <n> print the n chemicals slowest to align\n";
 	return 0;
     }
 
@@ -168,62 +340,455 @@ int main (int argc, char** argv)
     {
 	starg = iarg;
     
-	if (!strcmp(argv[iarg],"-1")) {
-	    single_header = 1;
+	if (arg_is (argv[iarg],"-1")) {
+	    options.single_header = 1;
 	    iarg++;
 	}
-	if (!strcmp(argv[iarg],"-d")) {
+	if (arg_is (argv[iarg],"-d")) {
 	    iarg++;
 	    if (argc < 3) {
 		std::cerr << "-d requires <diff> specification\n";
 		return -1;
 	    }
-	    char* ppend;
-	    adiff = strtof (argv[iarg],&ppend);
-	    if (adiff < 0 || *ppend != 0) {
-		std::cerr << "<diff> specification must be >= 0\n";
+// several comma separated values give one output file for each
+
+	    char* pdiff = argv[iarg];
+	    while (1) {
+		char* ppend;
+		float adiff = strtof (pdiff,&ppend);
+		if (adiff < 0 || ppend == pdiff || 
+		    (*ppend != 0 && *ppend != ',')) {
+		    std::cerr << "<diff> specification must be >= 0\n";
+		    return -1;
+		}
+		if (adiffs.size() >= MAXDIFFS) {
+		    std::cerr << "Maximum " << MAXDIFFS << 
+			" number of <diff> values exceeded\n";
+		    return -1;
+		}
+		adiffs.push_back (adiff);
+		difftexts.push_back (std::string (pdiff, ppend - pdiff));
+		if (*ppend != ',') {
+		    break;
+		}
+		pdiff = ppend + 1;
+	    }
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"-d2")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "-d2 requires <diff2> specification\n";
 		return -1;
 	    }
-	    if (adiff >= 1) {
-		afraction = false;
+	    char* ppend;
+	    options.adiff2 = strtof (argv[iarg],&ppend);
+	    if (options.adiff2 < 0 || ppend == argv[iarg] || *ppend != 0) {
+		std::cerr << "<diff2> specification must be >= 0\n";
+		return -1;
 	    }
+	    diff2text = argv[iarg];
 	    iarg++;
 	}
-	if (!strcmp(argv[iarg],"-o")) {
+	if (arg_is (argv[iarg],"-o")) {
 	    iarg++;
 	    if (argc < 3) {
 		std::cerr << "-o requires <outfilename> specification\n";
 		return -1;
 	    }
-	    if (FILE *testfile = fopen (argv[iarg],"r")) {
-		fclose (testfile);
-		std::cerr << "file named " << argv[iarg] << 
-		    " already exists and must be deleted first\n";
+	    outname = argv[iarg];
+	    outname_given = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"-m")) {
+	    options.LineTerminator = MICROSOFT_TERMINATOR;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"-r")) {
+	    options.restricted = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"-l")) {
+	    options.lazy = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--by-time")) {
+	    options.by_time = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--by-class")) {
+	    options.by_time = true;
+	    options.by_class = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--sequential-dp")) {
+	    options.sequential_dp = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--time1-range")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--time1-range requires <min>:<max> specification\n";
 		return -1;
 	    }
-	    outname = argv[iarg];
+	    char* ppend;
+	    options.MinTime1 = strtof (argv[iarg],&ppend);
+	    if (*ppend == ':') {
+		char* pmax = ppend + 1;
+		options.MaxTime1 = strtof (pmax,&ppend);
+		if (ppend == pmax) {
+		    ppend = pmax - 1;  // no max given
+		}
+	    }
+	    if (*ppend != 0 || options.MaxTime1 < options.MinTime1) {
+		std::cerr << "<min>:<max> specification must have min <= max\n";
+		return -1;
+	    }
+	    options.Time1Filter = true;
 	    iarg++;
 	}
-	if (!strcmp(argv[iarg],"-m")) {
-	    LineTerminator = MICROSOFT_TERMINATOR;
+	if (arg_is (argv[iarg],"--min-sn")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--min-sn requires <sn> specification\n";
+		return -1;
+	    }
+	    char* ppend;
+	    options.MinSN = strtod (argv[iarg],&ppend);
+	    if (*ppend != 0) {
+		std::cerr << "<sn> specification must be a number\n";
+		return -1;
+	    }
+	    options.SNFilter = true;
 	    iarg++;
 	}
-	if (!strcmp(argv[iarg],"-r")) {
-	    restricted = true;
+	if (arg_is (argv[iarg],"--min-area")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--min-area requires <area> specification\n";
+		return -1;
+	    }
+	    char* ppend;
+	    options.MinArea = strtod (argv[iarg],&ppend);
+	    if (*ppend != 0) {
+		std::cerr << "<area> specification must be a number\n";
+		return -1;
+	    }
+	    options.AreaFilter = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--chemicals")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--chemicals requires <listfile> specification\n";
+		return -1;
+	    }
+	    if (!aligncsv::read_chemical_list (argv[iarg], 
+						   options.IncludeChemicals)) {
+		std::cerr << "Unable to read chemical list: " << argv[iarg] 
+			  << "\n";
+		return -1;
+	    }
+	    options.IncludeFilter = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--exclude-chemicals")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--exclude-chemicals requires <listfile> specification\n";
+		return -1;
+	    }
+	    if (!aligncsv::read_chemical_list (argv[iarg], 
+						   options.ExcludeChemicals)) {
+		std::cerr << "Unable to read chemical list: " << argv[iarg] 
+			  << "\n";
+		return -1;
+	    }
+	    options.ExcludeFilter = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--serve")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--serve requires <socket> specification\n";
+		return -1;
+	    }
+	    servename = argv[iarg];
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--cache-mb")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--cache-mb requires <mb> specification\n";
+		return -1;
+	    }
+	    char* ppend;
+	    long mb = strtol (argv[iarg],&ppend,10);
+	    if (*ppend != 0 || ppend == argv[iarg] || mb < 0) {
+		std::cerr << "<mb> specification must be a whole number\n";
+		return -1;
+	    }
+	    cache_mb = mb;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--connect")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--connect requires <socket> specification\n";
+		return -1;
+	    }
+	    connectname = argv[iarg];
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--manifest")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--manifest requires <jobsfile> specification\n";
+		return -1;
+	    }
+	    manifestname = argv[iarg];
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--stats")) {
+	    options.stats = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--stats-json")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--stats-json requires <jsonfile> specification\n";
+		return -1;
+	    }
+	    options.stats = true;
+	    statsname = argv[iarg];
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--perf-counters")) {
+	    options.stats = true;
+	    options.perf_counters = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--trace")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--trace requires <tracefile> specification\n";
+		return -1;
+	    }
+	    tracename = argv[iarg];
+	    options.trace = &trace;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--report-chemicals")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--report-chemicals requires <n> specification\n";
+		return -1;
+	    }
+	    char* ppend;
+	    report_chemicals = strtol (argv[iarg],&ppend,10);
+	    if (*ppend != 0 || report_chemicals < 1) {
+		std::cerr << "<n> specification must be a whole number\n";
+		return -1;
+	    }
+	    options.chemical_costs = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--memory")) {
+	    memory = true;
+	    iarg++;
+	}
+	if (arg_is (argv[iarg],"--memory-project")) {
+	    iarg++;
+	    if (iarg >= argc) {
+		std::cerr << "--memory-project requires <nfiles> specification\n";
+		return -1;
+	    }
+	    char* ppend;
+	    project_files = strtol (argv[iarg],&ppend,10);
+	    if (*ppend != 0 || project_files < 1) {
+		std::cerr << "<nfiles> specification must be a whole number\n";
+		return -1;
+	    }
+	    memory = true;
 	    iarg++;
 	}
     }
 
-    std::ofstream outfile;
-    outfile.open(outname.c_str());
-    if (outfile.fail())
+// Say once why counters can't be counted, rather than in every report
+
+    if (options.perf_counters) {
+	aligncsv::PerfCounters probe;
+	std::string reason;
+	if (!(probe.open (&reason) & HARDWARE_COUNTERS)) {
+	    std::cout << "Hardware counters not available (" << reason
+		      << "), reporting times only\n";
+	} else if (!reason.empty()) {
+	    std::cout << "Some counters not available (" << reason << ")\n";
+	}
+    }
+
+    if (options.sequential_dp && options.adiff2 >= 0) {
+	std::cerr << "--sequential-dp is not used with -d2\n";
+	return -1;
+    }
+
+// A server reads its files when asked, so none are given here
+
+    if (tracename && (servename || connectname)) {
+	std::cerr << "--trace is not used with --serve or --connect\n";
+	return -1;
+    }
+    if (report_chemicals && (servename || connectname || manifestname)) {
+	std::cerr << "--report-chemicals is not used with --serve, --connect "
+	    "or --manifest\n";
+	return -1;
+    }
+
+// Only the reading options apply to all requests or jobs; each gives its
+//   own alignment options and output, so those aren't taken here
+
+    if ((servename || manifestname) &&
+	(options.single_header || !adiffs.empty() || options.adiff2 >= 0 ||
+	 outname_given || options.LineTerminator == MICROSOFT_TERMINATOR ||
+	 options.restricted || options.by_time || options.sequential_dp ||
+	 memory)) {
+	std::cerr << "-1, -d, -d2, -o, -m, -r, --by-time, --by-class, "
+	    "--sequential-dp and --memory are given\n  in each "
+		  << (servename ? "request, not with --serve\n" :
+		      "job, not with --manifest\n");
+	return -1;
+    }
+    if (servename) {
+	if (iarg < argc || connectname || manifestname) {
+	    std::cerr << "--serve does not take files, --connect or --manifest\n";
+	    return -1;
+	}
+	return aligncsv_serve (servename, options, cache_mb * 1048576);
+    }
+
+// Likewise the jobs in a manifest give their own files and outfiles
+
+    if (manifestname) {
+	if (iarg < argc || connectname) {
+	    std::cerr << "--manifest does not take files or --connect\n";
+	    return -1;
+	}
+	int status = aligncsv_manifest (manifestname, options, statsname);
+	int trace_status = write_trace (trace, tracename);
+	return status ? status : trace_status;
+    }
+    if (connectname && (options.lazy || options.Time1Filter ||
+			options.SNFilter || options.AreaFilter ||
+			options.IncludeFilter || options.ExcludeFilter)) {
+	std::cerr << "-l and filters are given to --serve, not --connect\n";
+	return -1;
+    }
+
+// With more than one <diff>, each output file name gets a _d<diff> suffix
+//   (e.g. aligncsv_d0.02.csv)
+
+    if (adiffs.empty()) {
+	adiffs.push_back (0.01);
+	difftexts.push_back ("0.01");
+    }
+    std::vector<std::string> outnames;
+    std::ofstream outfile[MAXDIFFS];
+    for (int idiff = 0; idiff < adiffs.size(); idiff++)
     {
-	std::cerr << "Unable to open output file\n";
-	return -10;
+	std::string diffname = outname;
+	if (adiffs.size() > 1) {
+	    std::string::size_type dot = outname.rfind ('.');
+	    if (dot == std::string::npos || 
+		outname.find ('/', dot) != std::string::npos) {
+		dot = outname.length();
+	    }
+	    diffname.insert (dot, "_d" + difftexts[idiff]);
+	}
+
+// Only the files actually written must not exist already (with several
+//   <diff> values, outfile itself isn't written)
+
+	if (outname_given) {
+	    if (FILE *testfile = fopen (diffname.c_str(),"r")) {
+		fclose (testfile);
+		std::cerr << "file named " << diffname << 
+		    " already exists and must be deleted first\n";
+		return -1;
+	    }
+	}
+	outnames.push_back (diffname);
+	outfile[idiff].open(diffname.c_str());
+	if (outfile[idiff].fail())
+	{
+	    std::cerr << "Unable to open output file\n";
+	    return -10;
+	}
     }
 
     int first_file_index = iarg;
 
+// With --connect, the server reads the files (so it is given their full
+//   names), and aligns them once for each <diff>
+
+    if (connectname) {
+	std::vector<std::string> request;
+	if (options.single_header) {
+	    request.push_back ("-1");
+	}
+	if (options.LineTerminator == MICROSOFT_TERMINATOR) {
+	    request.push_back ("-m");
+	}
+	if (options.restricted) {
+	    request.push_back ("-r");
+	}
+	if (options.adiff2 >= 0) {
+	    request.push_back ("-d2");
+	    request.push_back (diff2text);
+	}
+	if (options.by_class) {
+	    request.push_back ("--by-class");
+	} else if (options.by_time) {
+	    request.push_back ("--by-time");
+	}
+	if (options.sequential_dp) {
+	    request.push_back ("--sequential-dp");
+	}
+	std::vector<std::string> fullnames;
+	for (; iarg < argc; iarg++)
+	{
+	    char* fullname = realpath (argv[iarg], 0);
+	    if (!fullname) {
+		std::cerr << "No Such File: " << argv[iarg] << "\n";
+		return -1;
+	    }
+	    fullnames.push_back (fullname);
+	    free (fullname);
+	}
+	for (int idiff = 0; idiff < adiffs.size(); idiff++)
+	{
+	    std::vector<std::string> args = request;
+	    args.push_back ("-d");
+	    args.push_back (difftexts[idiff]);
+	    args.insert (args.end(), fullnames.begin(), fullnames.end());
+	    int rows = 0;
+	    std::string error;
+	    int status = aligncsv_request (connectname, args, outfile[idiff],
+					   rows, error);
+	    outfile[idiff].close();
+	    if (status) {
+		std::cerr << error;
+		return status;
+	    }
+	    std::cout << "\n" << rows << " records written to "
+		      << outnames[idiff] << "\n";
+	}
+	std::cout << "\n";
+	return 0;
+    }
+
+    aligncsv::Stats stats;
+    aligncsv::PhaseTimer timer (options.perf_counters);
+    double trace_start = tracename ? aligncsv::wall_seconds() : 0;
     for (; iarg < argc; iarg++)
     {
 	if (ninfiles >= MAXFILES)
@@ -245,578 +810,117 @@ int main (int argc, char** argv)
 	}
 	ninfiles++;
 	Filenames.push_back(argv[iarg]);
-	DataColumns.push_back(0);
+    }
+    if (options.stats) {
+	timer.stop (stats.phases[aligncsv::OPEN_PHASE]);
+    }
+    if (tracename) {
+	trace.span ("ingest", "open files", trace_start,
+		    aligncsv::wall_seconds());
     }
 
 // Read In Files
 
-    std::string aline;
-    std::string field;
-    std::string last_field = "";
-    int count_empties;
-    int record_size;
-    bool header2_required;
-
-    std::vector<std::vector<std::string> > Lines_in_file;
+    aligncsv::Aligner aligner (options);
     for (int ifile = 0; ifile < ninfiles; ifile++)
     {
-	FileData.clear();
-	std::vector<std::string> header1;
-	std::vector<std::string> header2;
-	header2_required = false;
-
 	std::cout << "\nReading file " << Filenames[ifile] << "\n";
-
-// Current design permits (but does not require) two headers
-//   First header is incomplete if there are nulls so second is then read
-//   Composite field names are constructed using both header values with
-//   HEADER_SEPARATOR in between.  The first header value, if null, is
-//   taken from the previously defined name.
-
-// CSV files created by Microsoft and similar programs are created with
-//   a non-standard trailing
-//   comma after the last non-null field (in effect, using comma as cell
-//   terminator rather than cell separator).  This is allowed for but not
-//   required (making this more complicated than I would like).
-
-//   read first header
-
-	getline (infile[ifile], aline);
-//	std::cout << "Got line1: " << aline << "\n";
-
-	std::stringstream sstream1(aline);
-	count_empties = 0;
-	bool last_field_empty = false;
-	bool last_empty_field_counted = false;
-	while(std::getline (sstream1, field, ',') )
-	{
-	    last_field_empty = false;
-	    last_empty_field_counted = false;
-//	    printf ("Got name: %s\n",field.c_str());
-	    if (field.empty())
-	    {
-		count_empties++;
-		field = last_field;
-		last_field_empty = true;
-		last_empty_field_counted = true;
-	    } else {
-// handle non-standard line terminators as uncounted empty
-		bool empty_field = false;
-		int flen = field.length();
-		if (flen < 3) {
-		    empty_field = true;
-		    for (int fin = 0; fin < flen; fin++)
-		    {
-			if (!std::isspace(field[fin]))
-			{
-			    empty_field = false;
-			}
-		    }
-		    if (empty_field)
-		    {
-//			std::cout << "...virtually empty\n";
-			field = last_field;
-			last_field_empty = true;
-		    }
-		}
-	    }
-	    header1.push_back (field);
+	int status = aligner.add_stream (Filenames[ifile], infile[ifile]);
+	if (status) {
+	    std::cerr << aligner.error();
+	    return status;
 	}
-
-	if (last_field_empty)
-	{
-//	    std::cout << "last field empty so popping\n";
-	    header1.pop_back();
-	}
-	if (last_empty_field_counted)
-	{
-	    count_empties--;
-	}
-
-	if (count_empties)
-	{
-	    header2_required = true;
-	}
-
-//   read second header if required
-
-	if (header2_required)
-	{
-	    count_empties = 0;
-	    getline (infile[ifile], aline);
-//	    printf ("Got line2: %s\n",aline.c_str());
-	    std::stringstream sstream2(aline);
-	    last_field_empty = false;
-	    last_empty_field_counted = false;
-	    while(std::getline (sstream2, field, ',') )
-	    {
-		last_field_empty = false;
-		last_empty_field_counted = false;
-//		printf ("Got name: %s\n",field.c_str());
-		if (field.empty())
-		{
-//		    std::cerr << "empty field in second header, file " <<
-//			Filenames[ifile];
-		    count_empties++;
-		    last_field_empty = true;
-		    last_empty_field_counted = true;
-		} else {
-// handle non-standard line terminators as uncounted empty
-		    bool empty_field = false;
-		    int flen = field.length();
-		    if (flen < 3) {
-			empty_field = true;
-			for (int fin = 0; fin < flen; fin++)
-			{
-			    if (!std::isspace(field[fin]))
-			    {
-				empty_field = false;
-			    }
-			}
-			if (empty_field)
-			{
-//			    std::cout << "...virtually empty\n";
-			    field = last_field;
-			    last_field_empty = true;
-			}
-		    }
-		}
-		header2.push_back (field);
-	    }
-	    if (last_field_empty)
-	    {
-//		std::cout << "last field empty so popping\n";
-		header2.pop_back();
-	    }
-	    if (last_empty_field_counted)
-	    {
-		count_empties--;
-	    }
-	    if (count_empties)
-	    {
-		std::cerr << "Second header has incomplete fields in file: "
-			  << Filenames[ifile] << "\n";
-		return -2;
-	    }
-	    if (header2.size() != header1.size())
-	    {
-		std::cerr << "First and second headers different size\n";
-		return -3;
-	    }
-	    record_size = header2.size();
+	if (aligner.file(ifile).two_headers) {
 	    std::cout << "Two headers read successfully.\n";
 	} else {
 	    std::cout << "One header read successfully.\n";
 	}
-
-// Create composite field names from both headers
-// Second header line becomes "suffix" (e.g. "@subject-1")
-//   If second header field is blank, the preceding non-blank, if any, is used
-// If quotes are present in either name, they apply to both but are removed
-//   in between.
-
-	std::vector<std::string> fields;
-	if (!header2_required)
-	{
-	    fields = header1;
-	}
-	else
-	{
-	    std::string last_suffix = "";
-	    for (int ich = 0; ich < record_size; ich++)
-	    {
-		bool quote_prefix = false;
-		bool quote_suffix = false; 
-		std::string composite = header2[ich];
-		if ('"' == composite[composite.length()-1]) {
-		    composite.erase(composite.length()-1);
-		    quote_prefix = true;
-		}
-
-		std::string suffix = header1[ich];
-		if (suffix.length() > 0) {
-		    last_suffix = suffix;
-		} else {
-		    if (last_suffix.length() > 0) {
-			suffix = last_suffix;
-		    } else {
-			suffix = "";
-		    }
-		}
-		if (suffix[0] == '"' ) {
-		    if (single_header) {
-			suffix.erase(0,1);
-		    }
-		    quote_suffix = true;
-		}
-		if (suffix.length() > 0) {
-		    composite += HEADER_SEPARATOR;
-		    composite += suffix;
-		}
-		if (quote_prefix && composite[composite.length()-1] != '"') {
-		    composite += "\"";
-		}
-		if (quote_suffix && !quote_prefix) {
-		    composite = "\"" + composite;
-		}
-		fields.push_back (composite);
-		Header.push_back (composite);
-		if (ifile==0 || ich > 0) {
-		    Header1.push_back (suffix);
-		    Header2.push_back (header2[ich]);
-		}
-		DataColumns[ifile]++;
-	    }
-	}
-	DataColumns[ifile]--;  // Remove peak column
-
-
-// ORIGINAL VERSION did this:
-// Read records into hashtable using composite names:
-//   Each hastable entry is a string (field value) and the key
-//     is <chemical_name>+<composite-field-name> because
-//     the chemical name applies to each row and the field name applies to
-//     the column within each row
-
-// REVISION 2 now does this:
-//   Original design was assuming only one record per chemical.  But
-//     a chemical may appear in multiple records in one file, and those
-//     records are distinguished by different values in the first and/or
-//     second retention time dimensions.  Joining is really understood as
-//     alighning related records, which have the same chemical AND
-//     similar first and second weight times.
-
-//   The new algorithm saves each LINE of fields by chemical name & sequential
-//   index number.  Information is saved this way separately for each file.
-//   and at the same time, a hash of chemical names is also created.
-//
-//   For output, we cycle through each chemical name.
-//     For each file having that chemical, we get the first retention
-//     time(s) available in records in that file (as an average for each
-//     applicable record).  Starting from the lowest
-//     retention time found in all files, we try to find matching lines in
-//     other files within 10%.  Once we have set of matching lines from all
-//     possible files, we start from the longest retention time in that
-//     group, and see if it better matches the next higher retention time(s)
-//     we would find, and thereby peel away the higher ones that that
-//     have better matches above, until the current line matches best.
-//
-//   The same selection method is applied to the second retention times.
-//     If the set of records found for second retention times is different,
-//     a warning message is given.
-//
-//  The complete set of matching lines is written to the output file and
-//     removed from the working set, and the algorithm continues until all
-//     chemicals have been processed.
-
-//  Each field in line of each file is stored as a std::vector of std::string
-//      (except the first chemical name field)
-//  That is then stored in a unordered_map using file-index, chemical-name,
-//    and record index number
-//
-
-	std::vector<std::string>* Fields;
-
-	while (getline(infile[ifile], aline))
-	{
-//	    std::cout << "Got line " << aline << "\n";
-
-// requires explicit parsing because there may be quoted fields
-//   first, get first field, chemicalName
-
-	    std::vector<std::string> Fields;
-
-	    int column = 0;
-	    std::string chemicalName;
-
-	    std::string::iterator it = aline.begin();
-	    bool finis = false;
-	    unsigned quotes = 0;
-	    char prev = 0;
-	    while ( !finis && it != aline.end() )
-	    {
-		switch (*it) {
-		case '"':
-		    ++quotes;
-		    break;
-		case ',':
-		    if (quotes == 0 || (prev == '"' && (quotes & 1) == 0)) {
-			finis = true;
-		    }
-		    break;
-		default:;
-		}
-		if (!finis) {
-		    chemicalName += prev = *it;
-		}
-		it++;
-	    }
-	    Chemicals.insert (chemicalName);
-
-//   next, get each field and add to table for this chemicalName and column
-
-	    std::string field;
-	    std::string key;
-	    while (1) {
-		finis = false;
-		quotes = 0;
-		field = "";
-		while ( !finis && it != aline.end() )
-		{
-		    bool cr = false;
-		    switch (*it) {
-		    case '"':
-			++quotes;
-			break;
-		    case ',':
-			if (quotes == 0 || (prev == '"' && (quotes & 1)==0)) {
-			    finis = true;
-			}
-			break;
-		    case '\r':
-			cr = true;
-			break;
-		    default:;
-		    }
-		    if (!finis && !cr) {
-			field += prev = *it;
-		    }
-		    it++;
-		}
-		Fields.push_back(field);
-		column++;
-		if (it == aline.end() ) {
-		    break;
-		}
-	    }
-	    ChemRecord chemrecord;
-	    chemrecord.fields = Fields;
-	    float stime = 0;
-
-// stof not supported in gcc 4.4.7
-//	    std::string::size_type sz;
-//	    stime = std::stof (Fields[1], &sz);
-
-// instead using strtof, and skip past quotes if used
-	    const int bufsiz = 128;
-	    char pstring[bufsiz];
-	    strncpy (pstring,Fields[1].c_str(),bufsiz);
-	    char* ppstring;
-	    if (pstring[0] == '"') {
-		ppstring = &pstring[1];
-	    } else {
-		ppstring = &pstring[0];
-	    }
-	    char* ppend;
-	    stime = strtof (ppstring, &ppend);
-	    if (stime==0 || (*ppend != '\0' && *ppend != '"')) {
-		std::cerr << "error reading time value: " << Fields[1] << "\n";
-		return -1;
-	    }
-	    chemrecord.time1 = stime;
-	    if (FileData.count(chemicalName)) {
-		FileData[chemicalName].push_back(chemrecord);
-	    } else {
-		std::vector<ChemRecord> crecords;
-		crecords.push_back(chemrecord);
-		FileData[chemicalName] = crecords;
-	    }
-	    
-	}
-	if (infile[ifile].bad()) {
-	    std::cerr << "error reading file\n";
-	    return -1;
-	}
-	AllFileData.push_back(FileData);
+	stats.add (aligner.file(ifile).stats);
     } // End reading all files
     std::cout << "Finished reading all files\n";
 
+// Align all the chemicals for each <diff> and write the output
+//   the files are only read once, and the alignments run in parallel
+//   when compiled with OpenMP (e.g. g++ -fopenmp)
 
-// write the output headers
+    std::cout << "Number of chemicals found: " << aligner.nchemicals() << "\n";
+    aligncsv::MemoryUsage usage;
+    if (memory) {
+	aligner.memory_usage (usage);
+	std::cout << "\nMemory after reading:\n";
+	report_memory (usage);
+    }
 
-    if (single_header || !header2_required) {
-	for (int ifield = 0; ifield < Header1.size(); ifield++)
-	{
-	    if (ifield > 0) {
-		outfile << ",";
-	    }
-	    outfile << Header[ifield];
+    int ndiffs = adiffs.size();
+    std::vector<int> records_written (ndiffs, 0);
+    std::vector<aligncsv::Stats> diffstats (ndiffs);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int idiff = 0; idiff < ndiffs; idiff++)
+    {
+	aligncsv::Stats* pstats =
+	    options.stats || memory || report_chemicals ? &diffstats[idiff] : 0;
+	aligncsv::CsvSink sink (outfile[idiff], options.LineTerminator);
+	aligner.align (adiffs[idiff], sink, pstats);
+	records_written[idiff] = sink.rows_written();
+	aligncsv::PhaseTimer close_timer (options.perf_counters);
+	double flush_start = tracename ? aligncsv::wall_seconds() : 0;
+	outfile[idiff].close();
+	if (pstats) {
+	    close_timer.stop (pstats->phases[aligncsv::WRITE_PHASE]);
+	    pstats->phases[aligncsv::WRITE_PHASE].bytes +=
+		sink.bytes_written();
 	}
-	outfile << LineTerminator;
-    } else {
-	std::string lastfield = "";
-	for (int ifield = 0; ifield < Header1.size(); ifield++) {
-	    if (ifield > 0) {
-		outfile << ",";
-	    }
-	    if (Header1[ifield] != lastfield) {
-		outfile << Header1[ifield];
-	    }
-	    lastfield = Header1[ifield];
+	if (tracename) {
+	    trace.span ("output", "flush " + outnames[idiff], flush_start,
+			aligncsv::wall_seconds());
 	}
-	outfile << LineTerminator;
-	if (header2_required)
-	{
-	    for (int ifield = 0; ifield < Header2.size(); ifield++) {
-		if (ifield > 0) {
-		    outfile << ",";
-		}
-		outfile << Header2[ifield];
+    }
+
+    for (int idiff = 0; idiff < ndiffs; idiff++)
+    {
+	std::cout << "\n" << records_written[idiff]
+		  << " records written to "
+		  << outnames[idiff] << "\n";
+	stats.add (diffstats[idiff]);
+    }
+    std::cout << "\n";
+
+// The aligned rows of every <diff> are counted, as they may be held at
+//   the same time
+
+    if (memory) {
+	usage.output = stats.output_bytes;
+	std::cout << "Memory after aligning:\n";
+	report_memory (usage);
+	if (project_files) {
+	    std::cout << "Projected memory for " << project_files
+		      << " files:\n";
+	    report_memory (usage.project (ninfiles, project_files), usage);
+	}
+	std::cout << "\n";
+    }
+    if (int status = write_trace (trace, tracename)) {
+	return status;
+    }
+    if (report_chemicals) {
+	stats.print_chemicals (std::cout, report_chemicals);
+	std::cout << "\n";
+    }
+    if (options.stats) {
+	int status = report_stats (stats, statsname);
+	if (options.perf_counters && stats.ingest().counted) {
+	    aligncsv::Stats::print_counter_header (std::cout, "file ingest");
+	    for (int ifile = 0; ifile < ninfiles; ifile++)
+	    {
+		aligncsv::Stats::print_counter_line
+		    (std::cout, Filenames[ifile],
+		     aligner.file(ifile).stats.ingest());
 	    }
-	    outfile << LineTerminator;
+	    std::cout << "\n";
 	}
+	return status;
     }
-
-//              WRITE OUTPUT DATA
-
-// iterate through each chemical seen
-
-     int records_written = 0;
-     std::cout << "Number of chemicals found: " << Chemicals.size() << "\n";
-     for (std::set<std::string>::iterator 
-	      it = Chemicals.begin(); it != Chemicals.end(); ++it)
-     {
-	 std::string keychem = *it;
-	 bool more_data_seen = true;
-	 while (more_data_seen) {
-	     std::string outline = keychem;
-	     
-// Obtain first and second lowest retention time records from all files
-
-	     std::vector<ChemRecord> lowest_recs;
-	     float lowest_time1 = 0;
-	     float second_lowest_time1 = 0;
-
-	     int ifile;
-	     more_data_seen = false;
-	     for (ifile = 0; ifile < ninfiles; ifile++)
-	     {
-		 if (AllFileData[ifile].count(keychem) && 
-		     AllFileData[ifile][keychem].size()) {
-// sort in place (lowest to back)
-		     std::sort (AllFileData[ifile][keychem].begin(),
-				AllFileData[ifile][keychem].end(),
-				ChemRecord::higher);
-
-// pop the lowest
-		     ChemRecord lowest  = AllFileData[ifile][keychem].back();
-		     AllFileData[ifile][keychem].pop_back();
-		     if (lowest_time1 == 0 ||
-			 lowest_time1 > lowest.time1) {
-			 lowest_time1 = lowest.time1;
-		     }
-		     lowest_recs.push_back(lowest);
-
-// check the second lowest for time only (don't pop)
-
-		     if (AllFileData[ifile][keychem].begin() ==
-			 AllFileData[ifile][keychem].end() ) {
-		     } else {
-			 more_data_seen = true;
-			 float test_lowest_time1 = 
-			     AllFileData[ifile][keychem].back().time1;
-			 if (second_lowest_time1 == 0 ||
-			     second_lowest_time1 > test_lowest_time1) {
-			     second_lowest_time1 = test_lowest_time1;
-			 }
-		     }
-		 } else {
-		     lowest_recs.push_back(NA);
-		 }
-	     }
-
-// Now, for each record in our lowest_recs set
-//    See if it is higher that adiff above the lowest
-//    See if it is closer to the second_lowest than lowest
-//      If either condition applies, push it back
-
-//	     std::cout << "aligning\n";
-	     for (ifile = 0; ifile < ninfiles; ifile++)
-	     {
-		 ChemRecord test_record = lowest_recs[ifile];
-		 float cutoff;
-		 if (afraction) {
-		     cutoff = (1 + adiff) * lowest_time1;
-		 } else {
-		     cutoff = lowest_time1 + adiff;
-		 }
-		 bool pushback = false;
-		 if (test_record.nfields() != 0) {
-		     if (test_record.time1 > cutoff) {
-			 pushback = true;
-		     } else if (test_record.time1 - lowest_time1 > 
-				std::abs(second_lowest_time1 - test_record.time1))
-		     {
-			 pushback = true;
-		     }
-		     if (pushback) {
-//			 std::cout << "doing pushback on record with time " <<
-//			     test_record.time1 << "\n";
-			 more_data_seen = true;
-			 AllFileData[ifile][keychem].push_back(test_record);
-			 lowest_recs[ifile] = NA;
-		     }
-		 }
-	     }
-
-// Accumulate all the lowest records that haven't been pushed back
-// Write out blanks for records that don't exist or have been pushed back
-
-//	     std::cout << "Accumulating\n";
-	     bool unfound = false;
-	     for (ifile=0; ifile < ninfiles; ifile++)
-	     {
-		 bool first_skipped = false;
-		 if (lowest_recs[ifile].nfields()) {
-		     std::vector<std::string>::iterator field = 
-			 lowest_recs[ifile].fields.begin();
-		     std::string last_field;
-		     int column = 0;
-		     for (; field != lowest_recs[ifile].fields.end();field++)
-		     {
-// data records may have extra terminating comma (microsoft nonstandard csv)
-// only fields with names are valid
-			 if (++column > DataColumns[ifile]) {
-			     break;
-			 }
-
-			 outline += ",";
-			 outline += *field;
-			 last_field = *field;
-		     }
-		 } else {
-// output empty fields for this file
-		     unfound = true;
-		     int column = 0;
-		     while (++column <= DataColumns[ifile])
-		     {
-			 outline += ",";
-		     }
-		 }
-	     }
-	     outline += LineTerminator;
-	     if (!unfound || !restricted) {
-		 OutputLines.push_back (OutputRecord(outline,lowest_time1));
-	     }
-	 }
-     }
-
-// Sort all output records by time1
-
-     std::sort (OutputLines.begin(),OutputLines.end(),OutputRecord::lower);
-
-// Write all output records
-
-     std::vector<OutputRecord>::iterator it;
-     for (it = OutputLines.begin(); it != OutputLines.end(); it++)
-     {
-	 outfile << it->line;
-	 records_written++;
-     }
-
-     std::cout << "\n" << records_written 
-	       << " records written to "
-	       << outname << "\n\n";
     return 0;
 }
-
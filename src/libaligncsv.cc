@@ -0,0 +1,3012 @@
+// Filename: libaligncsv.cc
+// Purpose: library for aligning multiple csv files produced by Chromatof
+//
+// See libaligncsv.h for the interface, and aligncsv_v4.cc for the file
+//   format and options.
+//-
+
+#include "libaligncsv.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <cctype>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <time.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Vector kernels are compiled with function target attributes, so the
+//   rest of the library needs no special flags and one binary runs on
+//   any x86 processor (gcc 5 or later, the first to take avx512bw as a
+//   target, or clang)
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+    __GNUC__ >= 5)
+#define X86_KERNELS 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace aligncsv {
+
+AlignOptions::AlignOptions ()
+{
+    single_header = 0;
+    restricted = false;
+    lazy = false;
+    stats = false;
+    perf_counters = false;
+    trace = 0;
+    chemical_costs = false;
+    adiff2 = -1;
+    by_time = false;
+    by_class = false;
+    sequential_dp = false;
+    unquoted_chemicals = false;
+    LineTerminator = UNIX_TERMINATOR;
+    Time1Filter = false;
+    MinTime1 = 0;
+    MaxTime1 = 0;
+    SNFilter = false;
+    MinSN = 0;
+    AreaFilter = false;
+    MinArea = 0;
+    IncludeFilter = false;
+    ExcludeFilter = false;
+}
+
+
+// Processor-specific kernels
+//
+// Most of the time reading a file is spent finding the characters that
+//   matter to the csv tokenizer (quote, comma and carriage return) among
+//   the ordinary characters of names and numbers.  A special_mask kernel
+//   marks them in a block of up to 64 bytes at once, using the widest
+//   vector instructions the processor has, chosen once when the library
+//   is loaded.  The environment variable ALIGNCSV_KERNEL (scalar, sse2,
+//   avx2 or avx512) can choose a narrower one, e.g. to compare them.
+//   (Lines are found with memchr, which the C library already vectorizes,
+//   and the other work per field, such as strtof, doesn't gain from
+//   vectors.)
+
+typedef unsigned long long BlockMask;  // a bit for each byte of a block
+#define BLOCK_SIZE 64
+
+static BlockMask special_mask_scalar (const char* p, int n)
+{
+    BlockMask mask = 0;
+    for (int ibyte = 0; ibyte < n; ibyte++)
+    {
+	char c = p[ibyte];
+	if (c == '"' || c == ',' || c == '\r') {
+	    mask |= (BlockMask) 1 << ibyte;
+	}
+    }
+    return mask;
+}
+
+#ifdef X86_KERNELS
+
+// A partial block is copied to a full one, as the vector loads would
+//   read past the end of the data (the avx512 kernel masks its load
+//   instead)
+
+static BlockMask partial_mask (BlockMask (*kernel) (const char*, int),
+			       const char* p, int n)
+{
+    char block[BLOCK_SIZE];
+    memcpy (block, p, n);
+    memset (block + n, 0, BLOCK_SIZE - n);
+    return kernel (block, BLOCK_SIZE);
+}
+
+__attribute__((target("sse2")))
+static BlockMask special_mask_sse2 (const char* p, int n)
+{
+    if (n < BLOCK_SIZE) {
+	return partial_mask (special_mask_sse2, p, n);
+    }
+    const __m128i quote = _mm_set1_epi8 ('"');
+    const __m128i comma = _mm_set1_epi8 (',');
+    const __m128i cr = _mm_set1_epi8 ('\r');
+    BlockMask mask = 0;
+    for (int ibyte = 0; ibyte < BLOCK_SIZE; ibyte += 16)
+    {
+	__m128i chunk = _mm_loadu_si128 ((const __m128i*) (p + ibyte));
+	__m128i found = _mm_or_si128 (_mm_cmpeq_epi8 (chunk, quote),
+				      _mm_cmpeq_epi8 (chunk, comma));
+	found = _mm_or_si128 (found, _mm_cmpeq_epi8 (chunk, cr));
+	mask |= (BlockMask) (unsigned) _mm_movemask_epi8 (found) << ibyte;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static BlockMask special_mask_avx2 (const char* p, int n)
+{
+    if (n < BLOCK_SIZE) {
+	return partial_mask (special_mask_avx2, p, n);
+    }
+    const __m256i quote = _mm256_set1_epi8 ('"');
+    const __m256i comma = _mm256_set1_epi8 (',');
+    const __m256i cr = _mm256_set1_epi8 ('\r');
+    BlockMask mask = 0;
+    for (int ibyte = 0; ibyte < BLOCK_SIZE; ibyte += 32)
+    {
+	__m256i chunk = _mm256_loadu_si256 ((const __m256i*) (p + ibyte));
+	__m256i found = _mm256_or_si256 (_mm256_cmpeq_epi8 (chunk, quote),
+					 _mm256_cmpeq_epi8 (chunk, comma));
+	found = _mm256_or_si256 (found, _mm256_cmpeq_epi8 (chunk, cr));
+	mask |= (BlockMask) (unsigned) _mm256_movemask_epi8 (found) << ibyte;
+    }
+    return mask;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static BlockMask special_mask_avx512 (const char* p, int n)
+{
+    __mmask64 load = n < BLOCK_SIZE ? ((__mmask64) 1 << n) - 1 :
+	~(__mmask64) 0;
+    __m512i chunk = _mm512_maskz_loadu_epi8 (load, p);
+    return (_mm512_cmpeq_epi8_mask (chunk, _mm512_set1_epi8 ('"')) |
+	    _mm512_cmpeq_epi8_mask (chunk, _mm512_set1_epi8 (',')) |
+	    _mm512_cmpeq_epi8_mask (chunk, _mm512_set1_epi8 ('\r'))) & load;
+}
+
+// Kernels the processor and operating system support, from cpuid (and
+//   xgetbv, as the system must save the wider registers)
+
+static bool kernel_supported (int kernel)
+{
+    unsigned eax, ebx, ecx, edx;
+    if (kernel == SCALAR_KERNEL) {
+	return true;
+    }
+    if (!__get_cpuid (1, &eax, &ebx, &ecx, &edx)) {
+	return false;
+    }
+    if (kernel == SSE2_KERNEL) {
+	return edx & (1 << 26);
+    }
+    bool osxsave = ecx & (1 << 27);
+    if (!osxsave || __get_cpuid_max (0, 0) < 7) {
+	return false;
+    }
+    unsigned xcr0_low, xcr0_high;
+    __asm__ ("xgetbv" : "=a" (xcr0_low), "=d" (xcr0_high) : "c" (0));
+    __cpuid_count (7, 0, eax, ebx, ecx, edx);
+    if (kernel == AVX2_KERNEL) {
+	return (xcr0_low & 0x6) == 0x6 && (ebx & (1 << 5));
+    }
+    if (kernel == AVX512_KERNEL) {
+	return (xcr0_low & 0xe6) == 0xe6 && (ebx & (1 << 16)) &&
+	    (ebx & (1 << 30));
+    }
+    return false;
+}
+
+#else
+
+static bool kernel_supported (int kernel)
+{
+    return kernel == SCALAR_KERNEL;
+}
+
+#endif
+
+typedef BlockMask (*SpecialMask) (const char* p, int n);
+
+static SpecialMask kernel_function (int kernel)
+{
+#ifdef X86_KERNELS
+    switch (kernel) {
+    case SSE2_KERNEL:
+	return special_mask_sse2;
+    case AVX2_KERNEL:
+	return special_mask_avx2;
+    case AVX512_KERNEL:
+	return special_mask_avx512;
+    default:;
+    }
+#endif
+    return special_mask_scalar;
+}
+
+static int best_kernel ()
+{
+    int best = SCALAR_KERNEL;
+    for (int kernel = SCALAR_KERNEL + 1; kernel < NKERNELS; kernel++)
+    {
+	if (kernel_supported (kernel)) {
+	    best = kernel;
+	}
+    }
+    const char* wanted = getenv ("ALIGNCSV_KERNEL");
+    if (wanted) {
+	for (int kernel = SCALAR_KERNEL; kernel < best; kernel++)
+	{
+	    if (!strcmp (wanted, cpu_kernel_name (kernel))) {
+		return kernel;
+	    }
+	}
+    }
+    return best;
+}
+
+static int Kernel = best_kernel();
+static SpecialMask special_mask = kernel_function (Kernel);
+
+const char* cpu_kernel_name (int kernel)
+{
+    static const char* names[NKERNELS] = {"scalar", "sse2", "avx2",
+					  "avx512"};
+    return kernel >= 0 && kernel < NKERNELS ? names[kernel] : "unknown";
+}
+
+int cpu_kernel ()
+{
+    return Kernel;
+}
+
+bool set_cpu_kernel (int kernel)
+{
+    if (kernel < 0 || kernel >= NKERNELS || !kernel_supported (kernel)) {
+	return false;
+    }
+    Kernel = kernel;
+    special_mask = kernel_function (kernel);
+    return true;
+}
+
+// Finds the special characters of a row, keeping the mask of the block
+//   last looked at, so that the fields of a row share the kernel calls.
+//   With the scalar kernel, the characters are just looked at in turn.
+
+class SpecialFinder {
+public:
+    SpecialFinder (const char* row_end)
+	: end(row_end), block(0), scalar(Kernel == SCALAR_KERNEL) {}
+    const char* next (const char* p) {
+	if (scalar) {
+	    while (p != end && *p != '"' && *p != ',' && *p != '\r') {
+		p++;
+	    }
+	    return p;
+	}
+	while (1) {
+	    if (!block || p < block || p >= block + BLOCK_SIZE) {
+		block = p;
+		mask = special_mask (p, std::min ((ptrdiff_t) BLOCK_SIZE,
+						  end - p));
+	    }
+	    BlockMask found = mask & (~(BlockMask) 0 << (p - block));
+	    if (found) {
+		return block + __builtin_ctzll (found);
+	    }
+	    if (end - block <= BLOCK_SIZE) {
+		return end;
+	    }
+	    p = block + BLOCK_SIZE;
+	}
+    }
+private:
+    const char* end;
+    const char* block;
+    BlockMask mask;
+    bool scalar;
+};
+
+
+// Scan one csv field starting at p and ending at an unquoted comma or end.
+//   Returns the position following the terminating comma.  Field text (if
+//   wanted) is appended to field.  A comma within quotes does not end the
+//   field.  Carriage returns are dropped only if drop_cr is set (they are
+//   kept in the chemical name).
+//
+// Runs of ordinary characters are found with finder (which must be for
+//   the same end) and copied at once; prev is the last character kept.
+
+static const char* scan_field (const char* p, const char* end,
+			       std::string* field, bool drop_cr,
+			       SpecialFinder& finder)
+{
+    unsigned quotes = 0;
+    char prev = 0;
+    while (p != end)
+    {
+	const char* special = finder.next (p);
+	if (special != p) {
+	    if (field) {
+		field->append (p, special - p);
+	    }
+	    prev = special[-1];
+	    p = special;
+	    if (p == end) {
+		break;
+	    }
+	}
+	switch (*p) {
+	case '"':
+	    ++quotes;
+	    break;
+	case ',':
+	    if (quotes == 0 || (prev == '"' && (quotes & 1) == 0)) {
+		return p + 1;
+	    }
+	    break;
+	case '\r':
+	    if (drop_cr) {
+		p++;
+		continue;
+	    }
+	    break;
+	}
+	prev = *p;
+	if (field) {
+	    *field += prev;
+	}
+	p++;
+    }
+    return p;
+}
+
+// Split the data fields of a row (everything after the chemical)
+
+static void split_fields (const char* p, const char* end,
+			  std::vector<std::string>& fields,
+			  SpecialFinder& finder)
+{
+    fields.clear();
+    while (1) {
+	fields.push_back (std::string());
+	p = scan_field (p, end, &fields.back(), true, finder);
+	if (p == end) {
+	    break;
+	}
+    }
+}
+
+// Get the field in the given column of a row (not counting the chemical)
+//   returns false if the row has fewer columns
+
+static bool nth_field (const char* p, const char* end, int column,
+		       std::string* field, SpecialFinder& finder)
+{
+    for (int icol = 0; icol < column; icol++)
+    {
+	if (p == end) {
+	    return false;
+	}
+	p = scan_field (p, end, 0, true, finder);
+    }
+    scan_field (p, end, field, true, finder);
+    return true;
+}
+
+// Get the next line (without its newline) like getline does
+//   returns false if there are no more lines
+
+static bool next_line (const char*& p, const char* end, std::string& aline)
+{
+    if (p >= end) {
+	aline.clear();
+	return false;
+    }
+    const char* line_end = (const char*) memchr (p, '\n', end - p);
+    if (!line_end) {
+	line_end = end;
+    }
+    aline.assign (p, line_end - p);
+    p = line_end + 1;
+    return true;
+}
+
+// Parse a time value, skipping a leading quote
+//   returns false if the value is not a number greater than zero (a zero,
+//   negative or nan time would stop the alignment loop from finishing)
+
+static bool parse_time (const std::string& text, float* ptime)
+{
+// stof not supported in gcc 4.4.7
+//	    std::string::size_type sz;
+//	    stime = std::stof (Fields[1], &sz);
+
+// instead using strtof, and skip past quotes if used
+    const int bufsiz = 128;
+    char pstring[bufsiz];
+    strncpy (pstring,text.c_str(),bufsiz);
+    pstring[bufsiz-1] = '\0';
+    char* ppstring;
+    if (pstring[0] == '"') {
+	ppstring = &pstring[1];
+    } else {
+	ppstring = &pstring[0];
+    }
+    char* ppend;
+    float stime = strtof (ppstring, &ppend);
+    if (!(stime > 0) || (*ppend != '\0' && *ppend != '"')) {
+	return false;
+    }
+    *ptime = stime;
+    return true;
+}
+
+// Remove one pair of surrounding double quotes, if present
+
+static std::string unquote (const std::string& text)
+{
+    if (text.length() > 1 && text[0] == '"' &&
+	text[text.length()-1] == '"') {
+	return text.substr (1, text.length()-2);
+    }
+    return text;
+}
+
+// Find the data column (not counting the chemical) having a header name
+//   with or without quotes, returns -1 if not found
+
+static int find_column (const std::vector<std::string>& names,
+			const char* name)
+{
+    for (int ich = 1; ich < names.size(); ich++)
+    {
+	if (unquote (names[ich]) == name) {
+	    return ich - 1;
+	}
+    }
+    return -1;
+}
+
+// Check that a numeric field is at least a minimum, skipping quotes
+//   a field that isn't a number never passes
+
+static bool at_least (const std::string& text, double minimum)
+{
+    const char* ptext = text.c_str();
+    if (*ptext == '"') {
+	ptext++;
+    }
+    char* ppend;
+    double value = strtod (ptext, &ppend);
+    if (ppend == ptext || (*ppend != '\0' && *ppend != '"')) {
+	return false;
+    }
+    return value >= minimum;
+}
+
+bool read_chemical_list (const char* filename,
+			 STDPRE::unordered_set<std::string>& names)
+{
+    std::ifstream listfile (filename);
+    if (!listfile.is_open()) {
+	return false;
+    }
+    std::string aline;
+    while (getline (listfile, aline))
+    {
+	if (!aline.empty() && aline[aline.length()-1] == '\r') {
+	    aline.erase (aline.length()-1);
+	}
+	if (!aline.empty()) {
+	    names.insert (unquote (aline));
+	}
+    }
+    return !listfile.bad();
+}
+
+// Check a chemical name against the include and exclude lists
+
+static bool chemical_wanted (const std::string& chemicalName,
+			     const AlignOptions& options)
+{
+    if (!options.IncludeFilter && !options.ExcludeFilter) {
+	return true;
+    }
+    std::string bare = unquote (chemicalName);
+    if (options.IncludeFilter && !options.IncludeChemicals.count (bare)) {
+	return false;
+    }
+    if (options.ExcludeFilter && options.ExcludeChemicals.count (bare)) {
+	return false;
+    }
+    return true;
+}
+
+int read_header (const std::string& aline, std::vector<std::string>& header)
+{
+    std::string field;
+    std::string last_field = "";
+    std::stringstream sstream(aline);
+    int count_empties = 0;
+    bool last_field_empty = false;
+    bool last_empty_field_counted = false;
+    while(std::getline (sstream, field, ',') )
+    {
+	last_field_empty = false;
+	last_empty_field_counted = false;
+//	printf ("Got name: %s\n",field.c_str());
+	if (field.empty())
+	{
+	    count_empties++;
+	    field = last_field;
+	    last_field_empty = true;
+	    last_empty_field_counted = true;
+	} else {
+// handle non-standard line terminators as uncounted empty
+	    bool empty_field = false;
+	    int flen = field.length();
+	    if (flen < 3) {
+		empty_field = true;
+		for (int fin = 0; fin < flen; fin++)
+		{
+		    if (!std::isspace(field[fin]))
+		    {
+			empty_field = false;
+		    }
+		}
+		if (empty_field)
+		{
+//		    std::cout << "...virtually empty\n";
+		    field = last_field;
+		    last_field_empty = true;
+		}
+	    }
+	}
+	header.push_back (field);
+    }
+
+    if (last_field_empty)
+    {
+//	std::cout << "last field empty so popping\n";
+	header.pop_back();
+    }
+    if (last_empty_field_counted)
+    {
+	count_empties--;
+    }
+    return count_empties;
+}
+
+
+// Create composite field names from both headers
+// Second header line becomes "suffix" (e.g. "@subject-1")
+//   If second header field is blank, the preceding non-blank, if any, is used
+// If quotes are present in either name, they apply to both but are removed
+//   in between.
+
+void composite_names (const std::vector<std::string>& header1,
+		      const std::vector<std::string>& header2,
+		      int single_header, std::vector<std::string>& composites,
+		      std::vector<std::string>* suffixes)
+{
+    composites.clear();
+    if (suffixes) {
+	suffixes->clear();
+    }
+    std::string last_suffix = "";
+    for (int ich = 0; ich < header2.size(); ich++)
+    {
+	bool quote_prefix = false;
+	bool quote_suffix = false;
+	std::string composite = header2[ich];
+	if (!composite.empty() && '"' == composite[composite.length()-1]) {
+	    composite.erase(composite.length()-1);
+	    quote_prefix = true;
+	}
+
+	std::string suffix = header1[ich];
+	if (suffix.length() > 0) {
+	    last_suffix = suffix;
+	} else {
+	    if (last_suffix.length() > 0) {
+		suffix = last_suffix;
+	    } else {
+		suffix = "";
+	    }
+	}
+	if (suffix[0] == '"' ) {
+	    if (single_header) {
+		suffix.erase(0,1);
+	    }
+	    quote_suffix = true;
+	}
+	if (suffix.length() > 0) {
+	    composite += HEADER_SEPARATOR;
+	    composite += suffix;
+	}
+	if (quote_prefix && (composite.empty() ||
+			     composite[composite.length()-1] != '"')) {
+	    composite += "\"";
+	}
+	if (quote_suffix && !quote_prefix) {
+	    composite = "\"" + composite;
+	}
+	composites.push_back (composite);
+	if (suffixes) {
+	    suffixes->push_back (suffix);
+	}
+    }
+}
+
+void split_row (const char* begin, const char* end, std::string& chemical,
+		std::vector<std::string>& fields)
+{
+    chemical.clear();
+    SpecialFinder finder (end);
+    const char* rest = scan_field (begin, end, &chemical, false, finder);
+    split_fields (rest, end, fields, finder);
+}
+
+
+// Phase statistics
+
+#ifdef _WIN32
+double wall_seconds ()
+{
+    return time (0);
+}
+
+double cpu_seconds ()
+{
+    return clock() / (double) CLOCKS_PER_SEC;
+}
+#else
+double wall_seconds ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double cpu_seconds ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+// Hardware event counters
+
+#ifdef __linux__
+static const unsigned counter_types[NCOUNTERS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+    PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+static const unsigned long long counter_configs[NCOUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_SW_PAGE_FAULTS};
+#endif
+
+PerfCounters::PerfCounters ()
+{
+    for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+    {
+	fds[icounter] = -1;
+    }
+}
+
+PerfCounters::~PerfCounters ()
+{
+#ifdef __linux__
+    for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+    {
+	if (fds[icounter] >= 0) {
+	    close (fds[icounter]);
+	}
+    }
+#endif
+}
+
+// Only user space events of this thread are counted, which is allowed at
+//   the default perf_event_paranoid setting
+
+unsigned PerfCounters::open (std::string* reason)
+{
+#ifdef __linux__
+    int first_error = 0;
+    for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+    {
+	if (fds[icounter] >= 0) {
+	    continue;
+	}
+	struct perf_event_attr attr;
+	memset (&attr, 0, sizeof attr);
+	attr.size = sizeof attr;
+	attr.type = counter_types[icounter];
+	attr.config = counter_configs[icounter];
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[icounter] = syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[icounter] < 0 && !first_error) {
+	    first_error = errno;
+	}
+    }
+    if (reason && first_error) {
+	switch (first_error) {
+	case ENOENT:
+	case EOPNOTSUPP:
+	    *reason = "not supported by this processor or virtual machine";
+	    break;
+	case EACCES:
+	case EPERM:
+	    *reason = "not permitted (see /proc/sys/kernel/perf_event_paranoid)";
+	    break;
+	case ENOSYS:
+	    *reason = "perf_event_open is not in this kernel";
+	    break;
+	default:
+	    *reason = strerror (first_error);
+	}
+    }
+#else
+    if (reason) {
+	*reason = "only counted on Linux";
+    }
+#endif
+    return opened();
+}
+
+unsigned PerfCounters::opened () const
+{
+    unsigned bits = 0;
+    for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+    {
+	if (fds[icounter] >= 0) {
+	    bits |= 1 << icounter;
+	}
+    }
+    return bits;
+}
+
+// A counter shared with other events runs only part of the time, so its
+//   count is scaled up to the whole time
+
+void PerfCounters::read (double counts[NCOUNTERS]) const
+{
+    for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+    {
+	counts[icounter] = 0;
+#ifdef __linux__
+	unsigned long long values[3];  // count, time enabled, time running
+	if (fds[icounter] >= 0 &&
+	    ::read (fds[icounter], values, sizeof values) == sizeof values &&
+	    values[2] > 0) {
+	    counts[icounter] = values[0] * ((double) values[1] / values[2]);
+	}
+#endif
+    }
+}
+
+void PhaseTimer::stop (PhaseStats& phase)
+{
+    phase.wall += wall_seconds() - wall0;
+    phase.cpu += cpu_seconds() - cpu0;
+    unsigned bits = counters.opened();
+    if (bits) {
+	double counts[NCOUNTERS];
+	counters.read (counts);
+	for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+	{
+	    phase.counts[icounter] += counts[icounter] - counts0[icounter];
+	}
+	phase.counted |= bits;
+    }
+}
+
+void PhaseStats::add (const PhaseStats& other)
+{
+    wall += other.wall;
+    cpu += other.cpu;
+    bytes += other.bytes;
+    records += other.records;
+    for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+    {
+	counts[icounter] += other.counts[icounter];
+    }
+    counted |= other.counted;
+}
+
+const char* Stats::counter_name (int counter)
+{
+    static const char* names[NCOUNTERS] = {
+	"cycles", "instructions", "cache misses", "branch misses",
+	"page faults"};
+    return names[counter];
+}
+
+const char* Stats::phase_name (int phase)
+{
+    static const char* names[NPHASES] = {
+	"open", "header parse", "row tokenize", "time parse", "alignment",
+	"output sort", "output write"};
+    return names[phase];
+}
+
+void Stats::add (const Stats& other)
+{
+    for (int iphase = 0; iphase < NPHASES; iphase++)
+    {
+	phases[iphase].add (other.phases[iphase]);
+    }
+    pushbacks += other.pushbacks;
+    output_bytes += other.output_bytes;
+    std::map<std::string,ChemicalCost>::const_iterator it;
+    for (it = other.chemicals.begin(); it != other.chemicals.end(); ++it)
+    {
+	chemicals[it->first].add (it->second);
+    }
+}
+
+void ChemicalCost::add (const ChemicalCost& other)
+{
+    seconds += other.seconds;
+    iterations += other.iterations;
+    pushbacks += other.pushbacks;
+    if (records.empty()) {
+	records = other.records;
+    }
+}
+
+static bool slower (const std::pair<const std::string,ChemicalCost>* c1,
+		    const std::pair<const std::string,ChemicalCost>* c2)
+{
+    if (c1->second.seconds != c2->second.seconds) {
+	return c1->second.seconds > c2->second.seconds;
+    }
+    return c1->first < c2->first;
+}
+
+// Each chemical is followed by its number of records in each file
+
+void Stats::print_chemicals (std::ostream& out, int nchemicals) const
+{
+    std::vector<const std::pair<const std::string,ChemicalCost>*> costs;
+    std::map<std::string,ChemicalCost>::const_iterator it;
+    for (it = chemicals.begin(); it != chemicals.end(); ++it)
+    {
+	costs.push_back (&*it);
+    }
+    if (nchemicals > costs.size()) {
+	nchemicals = costs.size();
+    }
+    std::partial_sort (costs.begin(), costs.begin() + nchemicals, costs.end(),
+		       slower);
+    double total = 0;
+    for (int icost = 0; icost < costs.size(); icost++)
+    {
+	total += costs[icost]->second.seconds;
+    }
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << "Slowest " << nchemicals << " of " << costs.size()
+	<< " chemicals in alignment:\n";
+    out << std::setw(10) << "ms" << std::setw(8) << "% time"
+	<< std::setw(12) << "iterations" << std::setw(11) << "pushbacks"
+	<< std::setw(10) << "records" << "  chemical\n";
+    out << std::fixed;
+    for (int icost = 0; icost < nchemicals; icost++)
+    {
+	const ChemicalCost& cost = costs[icost]->second;
+	size_t nrecords = 0;
+	for (int ifile = 0; ifile < cost.records.size(); ifile++)
+	{
+	    nrecords += cost.records[ifile];
+	}
+	out << std::setprecision(3) << std::setw(10) << cost.seconds * 1000
+	    << std::setprecision(1) << std::setw(8)
+	    << (total > 0 ? 100 * cost.seconds / total : 0)
+	    << std::setw(12) << cost.iterations << std::setw(11)
+	    << cost.pushbacks << std::setw(10) << nrecords << "  "
+	    << costs[icost]->first << "\n";
+	out << std::setw(40) << "per file:";
+	for (int ifile = 0; ifile < cost.records.size(); ifile++)
+	{
+	    out << " " << cost.records[ifile];
+	}
+	out << "\n";
+    }
+    out.flags (flags);
+    out.precision (precision);
+}
+
+static double per_second (size_t count, double seconds)
+{
+    return seconds > 0 ? count / seconds : 0;
+}
+
+void Stats::print (std::ostream& out) const
+{
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::setw(14) << std::left << "phase" << std::right
+	<< std::setw(10) << "wall s" << std::setw(10) << "cpu s"
+	<< std::setw(14) << "bytes" << std::setw(11) << "records"
+	<< std::setw(13) << "records/s" << "\n";
+    PhaseStats total;
+    for (int iphase = 0; iphase < NPHASES; iphase++)
+    {
+	const PhaseStats& phase = phases[iphase];
+	out << std::setw(14) << std::left << phase_name (iphase) << std::right
+	    << std::fixed << std::setprecision(4)
+	    << std::setw(10) << phase.wall << std::setw(10) << phase.cpu
+	    << std::setw(14) << phase.bytes << std::setw(11) << phase.records
+	    << std::setprecision(0) << std::setw(13)
+	    << per_second (phase.records, phase.wall) << "\n";
+	total.wall += phase.wall;
+	total.cpu += phase.cpu;
+    }
+    out << std::setw(14) << std::left << "total" << std::right
+	<< std::setprecision(4) << std::setw(10) << total.wall
+	<< std::setw(10) << total.cpu << "\n";
+    out << "Pushbacks in alignment: " << pushbacks << "\n";
+    out.flags (flags);
+    out.precision (precision);
+    print_counters (out);
+}
+
+PhaseStats Stats::ingest () const
+{
+    PhaseStats reading;
+    for (int iphase = OPEN_PHASE; iphase <= TIME_PHASE; iphase++)
+    {
+	reading.add (phases[iphase]);
+    }
+    reading.records = phases[TOKENIZE_PHASE].records;
+    return reading;
+}
+
+void Stats::print_counter_header (std::ostream& out, const char* title)
+{
+    out << std::setw(14) << std::left << title << std::right
+	<< std::setw(15) << "cycles" << std::setw(15) << "instructions"
+	<< std::setw(7) << "IPC" << std::setw(16) << "cache miss/rec"
+	<< std::setw(17) << "branch miss/rec" << std::setw(13)
+	<< "page faults" << "\n";
+}
+
+// Counts not taken are shown as n/a, and rates without records as -
+
+static void print_count (std::ostream& out, int width, const PhaseStats& phase,
+			 int counter, bool per_record)
+{
+    out << std::setw(width);
+    if (!(phase.counted & (1 << counter))) {
+	out << "n/a";
+    } else if (!per_record) {
+	out << std::setprecision(0) << phase.counts[counter];
+    } else if (phase.records) {
+	out << std::setprecision(3) << phase.counts[counter] / phase.records;
+    } else {
+	out << "-";
+    }
+}
+
+void Stats::print_counter_line (std::ostream& out, const std::string& name,
+				const PhaseStats& phase)
+{
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    if (name.length() < 14) {
+	out << std::setw(14) << std::left << name << std::right << std::fixed;
+    } else {
+	out << name << "\n" << std::setw(14) << "" << std::fixed;  // file names
+    }
+    print_count (out, 15, phase, CYCLES_COUNTER, false);
+    print_count (out, 15, phase, INSTRUCTIONS_COUNTER, false);
+    unsigned ipc_bits = 1 << CYCLES_COUNTER | 1 << INSTRUCTIONS_COUNTER;
+    out << std::setw(7);
+    if ((phase.counted & ipc_bits) == ipc_bits &&
+	phase.counts[CYCLES_COUNTER] > 0) {
+	out << std::setprecision(2) << phase.counts[INSTRUCTIONS_COUNTER] /
+	    phase.counts[CYCLES_COUNTER];
+    } else {
+	out << "n/a";
+    }
+    print_count (out, 16, phase, CACHE_MISS_COUNTER, true);
+    print_count (out, 17, phase, BRANCH_MISS_COUNTER, true);
+    print_count (out, 13, phase, PAGE_FAULT_COUNTER, false);
+    out << "\n";
+    out.flags (flags);
+    out.precision (precision);
+}
+
+void Stats::print_counters (std::ostream& out) const
+{
+    PhaseStats total;
+    for (int iphase = 0; iphase < NPHASES; iphase++)
+    {
+	total.add (phases[iphase]);
+    }
+    if (!total.counted) {
+	return;
+    }
+    out << "\nEvent counters:\n";
+    print_counter_header (out, "phase");
+    for (int iphase = 0; iphase < NPHASES; iphase++)
+    {
+	print_counter_line (out, phase_name (iphase), phases[iphase]);
+    }
+    total.records = 0;  // records are counted in more than one phase
+    print_counter_line (out, "total", total);
+}
+
+void Stats::write_json (std::ostream& out) const
+{
+    out << "{\n  \"phases\": [\n";
+    for (int iphase = 0; iphase < NPHASES; iphase++)
+    {
+	const PhaseStats& phase = phases[iphase];
+	out << "    {\"name\": \"" << phase_name (iphase)
+	    << "\", \"wall_s\": " << phase.wall
+	    << ", \"cpu_s\": " << phase.cpu
+	    << ", \"bytes\": " << phase.bytes
+	    << ", \"records\": " << phase.records
+	    << ", \"records_per_s\": "
+	    << per_second (phase.records, phase.wall);
+	for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+	{
+	    if (phase.counted & (1 << icounter)) {
+		std::string name = counter_name (icounter);
+		std::replace (name.begin(), name.end(), ' ', '_');
+		out << ", \"" << name << "\": "
+		    << (unsigned long long) phase.counts[icounter];
+	    }
+	}
+	out << "}" << (iphase < NPHASES - 1 ? ",\n" : "\n");
+    }
+    out << "  ],\n  \"pushbacks\": " << pushbacks << "\n}\n";
+}
+
+
+// Timeline
+
+Trace::Trace ()
+{
+    wall0 = wall_seconds();
+}
+
+// Each thread's track, numbered as threads first add a span
+//   (omp_get_thread_num() is only a thread's number within its own team,
+//   so in nested parallel regions different threads share numbers)
+
+#ifdef _OPENMP
+static int trace_thread = -1;
+#pragma omp threadprivate (trace_thread)
+static int trace_threads = 0;
+#endif
+
+static int thread_number ()
+{
+#ifdef _OPENMP
+    if (trace_thread < 0) {
+#pragma omp critical (aligncsv_trace_thread)
+	trace_thread = trace_threads++;
+    }
+    return trace_thread;
+#else
+    return 0;
+#endif
+}
+
+void Trace::span (const char* category, const std::string& name,
+		  double start, double end, const std::string& args)
+{
+    Span span;
+    span.category = category;
+    span.name = name;
+    span.args = args;
+    span.thread = thread_number();
+    span.start = start - wall0;
+    span.end = end - wall0;
+#ifdef _OPENMP
+#pragma omp critical (aligncsv_trace)
+#endif
+    Spans.push_back (span);
+}
+
+// The length of the UTF-8 character starting at text[ichar], or 0 if the
+//   bytes there aren't one
+
+static int utf8_length (const std::string& text, int ichar)
+{
+    unsigned char c = text[ichar];
+    int length = (c >= 0xc2 && c <= 0xdf) ? 2 : (c >= 0xe0 && c <= 0xef) ? 3 :
+	(c >= 0xf0 && c <= 0xf4) ? 4 : 0;
+    if (length == 0 || ichar + length > text.length()) {
+	return 0;
+    }
+
+// The second byte's range excludes overlong forms, surrogates and code
+//   points past U+10FFFF
+
+    unsigned char low = (c == 0xe0) ? 0xa0 : (c == 0xf0) ? 0x90 : 0x80;
+    unsigned char high = (c == 0xed) ? 0x9f : (c == 0xf4) ? 0x8f : 0xbf;
+    for (int inext = 1; inext < length; inext++)
+    {
+	unsigned char next = text[ichar + inext];
+	if (next < low || next > high) {
+	    return 0;
+	}
+	low = 0x80;
+	high = 0xbf;
+    }
+    return length;
+}
+
+// Quote a string for json, escaping control characters.  UTF-8 characters
+//   are copied as they are, and any other byte of 0x80 or more (as from a
+//   Latin-1 file) is escaped as the Latin-1 character it would be, so the
+//   file is valid whatever the encoding of chemical and file names.
+
+static std::string json_string (const std::string& text)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string quoted = "\"";
+    for (int ichar = 0; ichar < text.length(); ichar++)
+    {
+	unsigned char c = text[ichar];
+	int length = (c < 0x80) ? 1 : utf8_length (text, ichar);
+	if (c == '"' || c == '\\') {
+	    quoted += '\\';
+	    quoted += c;
+	} else if (c < 0x20 || c == 0x7f || length == 0) {
+	    quoted += "\\u00";
+	    quoted += hex[c >> 4];
+	    quoted += hex[c & 0xf];
+	} else {
+	    quoted.append (text, ichar, length);
+	    ichar += length - 1;
+	}
+    }
+    return quoted + "\"";
+}
+
+void Trace::arg (std::string& args, const char* name, double value)
+{
+    std::ostringstream text;
+    text << value;
+    if (!args.empty()) {
+	args += ", ";
+    }
+    args += std::string("\"") + name + "\": " + text.str();
+}
+
+void Trace::arg (std::string& args, const char* name,
+		 const std::string& value)
+{
+    if (!args.empty()) {
+	args += ", ";
+    }
+    args += std::string("\"") + name + "\": " + json_string (value);
+}
+
+bool Trace::Span::before (const Span& s1, const Span& s2)
+{
+    if (s1.thread != s2.thread) {
+	return s1.thread < s2.thread;
+    }
+    return s1.start < s2.start;
+}
+
+// Complete ("X") events with times in microseconds, then a name for each
+//   thread's track
+
+void Trace::write (std::ostream& out) const
+{
+    std::vector<Span> spans (Spans);
+    std::stable_sort (spans.begin(), spans.end(), Span::before);
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\": [\n";
+    std::set<int> threads;
+    for (int ispan = 0; ispan < spans.size(); ispan++)
+    {
+	const Span& span = spans[ispan];
+	out << "  {\"name\": " << json_string (span.name)
+	    << ", \"cat\": \"" << span.category
+	    << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << span.thread
+	    << ", \"ts\": " << span.start * 1e6
+	    << ", \"dur\": " << (span.end - span.start) * 1e6
+	    << ", \"args\": {" << span.args << "}},\n";
+	threads.insert (span.thread);
+    }
+    out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+	"\"args\": {\"name\": \"aligncsv\"}}";
+    for (std::set<int>::const_iterator it = threads.begin();
+	 it != threads.end(); ++it)
+    {
+	out << ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+	    << "\"tid\": " << *it << ", \"args\": {\"name\": \"thread "
+	    << *it << "\"}}";
+    }
+    out << "\n],\n\"displayTimeUnit\": \"ms\"}\n";
+    out.flags (flags);
+    out.precision (precision);
+}
+
+// The records read from a file, for trace spans
+
+static size_t count_records (const RecordMap& records)
+{
+    size_t nrecords = 0;
+    for (RecordMap::const_iterator it = records.begin(); it != records.end();
+	 ++it)
+    {
+	nrecords += it->second.size();
+    }
+    return nrecords;
+}
+
+static void trace_parse (const AlignOptions& options, const std::string& name,
+			 double start, size_t size, const RecordMap& records)
+{
+    std::string args;
+    Trace::arg (args, "file", name);
+    Trace::arg (args, "bytes", size);
+    Trace::arg (args, "records", count_records (records));
+    options.trace->span ("ingest", "parse " + name, start, wall_seconds(),
+			 args);
+}
+
+
+int InputFile::read_stream (const std::string& filename, std::istream& in,
+			    const AlignOptions& options)
+{
+    name = filename;
+    std::string contents;
+    std::string& buffer = options.lazy ? text : contents;
+    PhaseTimer timer (options.perf_counters);
+    double trace_start = options.trace ? wall_seconds() : 0;
+    buffer.assign (std::istreambuf_iterator<char>(in),
+		   std::istreambuf_iterator<char>());
+    if (options.stats) {
+	timer.stop (stats.phases[OPEN_PHASE]);
+	stats.phases[OPEN_PHASE].bytes += buffer.size();
+    }
+    if (options.trace) {
+	std::string args;
+	Trace::arg (args, "file", name);
+	Trace::arg (args, "bytes", buffer.size());
+	double read_end = wall_seconds();
+	options.trace->span ("ingest", "read " + name, trace_start, read_end,
+			     args);
+	trace_start = read_end;
+    }
+    if (in.bad()) {
+	error = "error reading file\n";
+	return -1;
+    }
+    int status = read_text (buffer.data(), buffer.size(), options);
+    if (options.trace) {
+	trace_parse (options, name, trace_start, buffer.size(), records);
+    }
+    return status;
+}
+
+int InputFile::read_buffer (const std::string& filename, const char* data,
+			    size_t size, const AlignOptions& options)
+{
+    name = filename;
+    double trace_start = options.trace ? wall_seconds() : 0;
+    int status;
+    if (options.lazy) {
+	text.assign (data, size);
+	status = read_text (text.data(), text.size(), options);
+    } else {
+	status = read_text (data, size, options);
+    }
+    if (options.trace) {
+	trace_parse (options, name, trace_start, size, records);
+    }
+    return status;
+}
+
+// Memory accounting
+
+// A string within the short string buffer (the capacity of an empty
+//   string) has no heap storage
+
+static size_t heap_bytes (const std::string& s)
+{
+    static const size_t sso = std::string().capacity();
+    return s.capacity() <= sso ? 0 : s.capacity() + 1;
+}
+
+static size_t heap_bytes (const std::vector<std::string>& strings)
+{
+    size_t bytes = strings.capacity() * sizeof (std::string);
+    for (int i = 0; i < strings.size(); i++)
+    {
+	bytes += heap_bytes (strings[i]);
+    }
+    return bytes;
+}
+
+size_t MemoryUsage::total () const
+{
+    return index + records + fields + text + headers + chemicals + output;
+}
+
+void MemoryUsage::add (const MemoryUsage& other)
+{
+    index += other.index;
+    records += other.records;
+    fields += other.fields;
+    text += other.text;
+    headers += other.headers;
+    chemicals += other.chemicals;
+    output += other.output;
+}
+
+static void print_mb (std::ostream& out, const char* name, size_t bytes)
+{
+    out << "  " << std::setw(16) << std::left << name << std::right
+	<< std::setw(10) << bytes / 1048576.0 << " MB\n";
+}
+
+void MemoryUsage::print (std::ostream& out) const
+{
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    print_mb (out, "record index", index);
+    print_mb (out, "records", records);
+    print_mb (out, "field strings", fields);
+    print_mb (out, "row text (-l)", text);
+    print_mb (out, "headers", headers);
+    print_mb (out, "chemical set", chemicals);
+    print_mb (out, "aligned rows", output);
+    print_mb (out, "total", total());
+    out.flags (flags);
+    out.precision (precision);
+}
+
+MemoryUsage MemoryUsage::project (int nfiles, int nprojected) const
+{
+    MemoryUsage projected = *this;
+    if (nfiles < 1) {
+	return projected;
+    }
+    double scale = nprojected / (double) nfiles;
+    projected.index = (size_t) (index * scale);
+    projected.records = (size_t) (records * scale);
+    projected.fields = (size_t) (fields * scale);
+    projected.text = (size_t) (text * scale);
+    projected.headers = (size_t) (headers * scale);
+
+// Each row is an AlignedRow and a pointer for each file
+
+    double row_bytes = sizeof (AlignedRow) + nfiles * sizeof (void*);
+    double projected_row_bytes = sizeof (AlignedRow) +
+	nprojected * sizeof (void*);
+    projected.output = (size_t) (output * projected_row_bytes / row_bytes);
+    return projected;
+}
+
+void resident_memory (size_t& current, size_t& peak)
+{
+    current = 0;
+    peak = 0;
+    std::ifstream status ("/proc/self/status");
+    std::string line;
+    while (std::getline (status, line)) {
+	if (!line.compare (0, 6, "VmRSS:")) {
+	    current = (size_t) atol (line.c_str() + 6) * 1024;
+	} else if (!line.compare (0, 6, "VmHWM:")) {
+	    peak = (size_t) atol (line.c_str() + 6) * 1024;
+	}
+    }
+#ifndef _WIN32
+    if (!peak) {
+	struct rusage usage;
+	if (!getrusage (RUSAGE_SELF, &usage)) {
+#ifdef __APPLE__
+	    peak = usage.ru_maxrss;          // bytes
+#else
+	    peak = usage.ru_maxrss * 1024;   // kilobytes
+#endif
+	}
+    }
+#endif
+}
+
+// Each chemical in the map has a node (with the next node pointer and the
+//   hash), a bucket and its key
+
+void InputFile::memory_usage (MemoryUsage& usage) const
+{
+    usage.headers += heap_bytes (header1) + heap_bytes (header2);
+    usage.text += text.capacity();
+    usage.index += records.bucket_count() * sizeof (void*);
+    for (RecordMap::const_iterator it = records.begin();
+	 it != records.end(); ++it)
+    {
+	const std::vector<ChemRecord>& recs = it->second;
+	usage.index += sizeof (RecordMap::value_type) + 2 * sizeof (void*) +
+	    heap_bytes (it->first);
+	usage.records += recs.capacity() * sizeof (ChemRecord);
+	for (int irec = 0; irec < recs.size(); irec++)
+	{
+	    usage.fields += heap_bytes (recs[irec].fields);
+	}
+    }
+}
+
+size_t InputFile::memory_used () const
+{
+    MemoryUsage usage;
+    memory_usage (usage);
+    return sizeof *this + heap_bytes (name) + heap_bytes (error) +
+	usage.total();
+}
+
+size_t AlignedRow::memory (const std::vector<AlignedRow>& rows)
+{
+    size_t bytes = rows.capacity() * sizeof (AlignedRow);
+    for (int irow = 0; irow < rows.size(); irow++)
+    {
+	bytes += rows[irow].records.capacity() * sizeof (const ChemRecord*);
+    }
+    return bytes;
+}
+
+int InputFile::read_text (const char* data, size_t size,
+			  const AlignOptions& options)
+{
+    const char* next = data;
+    const char* text_end = data + size;
+    std::string aline;
+    bool timing = options.stats;
+    PhaseTimer timer (options.perf_counters);
+
+// Current design permits (but does not require) two headers
+//   First header is incomplete if there are nulls so second is then read
+//   Composite field names are constructed using both header values with
+//   HEADER_SEPARATOR in between.  The first header value, if null, is
+//   taken from the previously defined name.
+
+// CSV files created by Microsoft and similar programs are created with
+//   a non-standard trailing
+//   comma after the last non-null field (in effect, using comma as cell
+//   terminator rather than cell separator).  This is allowed for but not
+//   required (making this more complicated than I would like).
+
+//   read first header
+
+    next_line (next, text_end, aline);
+    if (read_header (aline, header1))
+    {
+	two_headers = true;
+    }
+
+//   read second header if required
+
+    if (two_headers)
+    {
+	next_line (next, text_end, aline);
+	if (read_header (aline, header2))
+	{
+	    error = "Second header has incomplete fields in file: " + name +
+		"\n";
+	    return -2;
+	}
+	if (header2.size() != header1.size())
+	{
+	    error = "First and second headers different size\n";
+	    return -3;
+	}
+    }
+    if (timing) {
+	timer.stop (stats.phases[HEADER_PHASE]);
+	stats.phases[HEADER_PHASE].bytes += next - data;
+	stats.phases[HEADER_PHASE].records += two_headers ? 2 : 1;
+    }
+
+// Locate the columns needed by the S/N and Area filters
+
+    int sn_column = -1;
+    int area_column = -1;
+    if (options.SNFilter || options.AreaFilter)
+    {
+	std::vector<std::string>& names = two_headers ? header2 : header1;
+	sn_column = find_column (names, "S/N");
+	area_column = find_column (names, "Area");
+	if ((options.SNFilter && sn_column < 0) ||
+	    (options.AreaFilter && area_column < 0))
+	{
+	    error = "S/N or Area column needed for filter not found in file: "
+		+ name + "\n";
+	    return -1;
+	}
+    }
+
+// ORIGINAL VERSION did this:
+// Read records into hashtable using composite names:
+//   Each hastable entry is a string (field value) and the key
+//     is <chemical_name>+<composite-field-name> because
+//     the chemical name applies to each row and the field name applies to
+//     the column within each row
+
+// REVISION 2 now does this:
+//   Original design was assuming only one record per chemical.  But
+//     a chemical may appear in multiple records in one file, and those
+//     records are distinguished by different values in the first and/or
+//     second retention time dimensions.  Joining is really understood as
+//     alighning related records, which have the same chemical AND
+//     similar first and second weight times.
+
+//   The new algorithm saves each LINE of fields by chemical name & sequential
+//   index number.  Information is saved this way separately for each file.
+//   and at the same time, a hash of chemical names is also created.
+//
+//   For output, we cycle through each chemical name.
+//     For each file having that chemical, we get the first retention
+//     time(s) available in records in that file (as an average for each
+//     applicable record).  Starting from the lowest
+//     retention time found in all files, we try to find matching lines in
+//     other files within 10%.  Once we have set of matching lines from all
+//     possible files, we start from the longest retention time in that
+//     group, and see if it better matches the next higher retention time(s)
+//     we would find, and thereby peel away the higher ones that that
+//     have better matches above, until the current line matches best.
+//
+//   The same selection method is applied to the second retention times.
+//     If the set of records found for second retention times is different,
+//     a warning message is given.
+//
+//  The complete set of matching lines is written to the output file and
+//     removed from the working set, and the algorithm continues until all
+//     chemicals have been processed.
+
+//  Each field in line of each file is stored as a std::vector of std::string
+//      (except the first chemical name field)
+//  That is then stored in a unordered_map using file-index, chemical-name,
+//    and record index number
+//
+//  Lazy mode only scans the chemical name and time here, and each record
+//    points to the rest of its row, which is split when it is written.
+
+//  With --stats, the time parse is timed for each row (wall time only),
+//    and the rest of the row loop, including sorting, is row tokenize
+
+    PhaseStats& tokenize = stats.phases[TOKENIZE_PHASE];
+    PhaseStats& time_parse = stats.phases[TIME_PHASE];
+    double time_wall = 0;
+    size_t nrows = 0;
+    const char* rows_start = next;
+    timer.start();
+    while (next < text_end)
+    {
+	const char* line_end = (const char*)
+	    memchr (next, '\n', text_end - next);
+	if (!line_end) {
+	    line_end = text_end;
+	}
+
+// requires explicit parsing because there may be quoted fields
+//   first, get first field, chemicalName
+
+	std::string chemicalName;
+	SpecialFinder finder (line_end);
+	const char* rest = scan_field (next, line_end, &chemicalName, false,
+				       finder);
+	next = line_end + 1;
+	nrows++;
+
+// skip the rest of the line if this chemical isn't wanted, else key it
+//   (without quotes if unquoted_chemicals)
+
+	if (!chemical_wanted (chemicalName, options)) {
+	    continue;
+	}
+	if (options.unquoted_chemicals) {
+	    chemicalName = unquote (chemicalName);
+	}
+
+//   next, get the fields (or just the time in lazy mode)
+
+	ChemRecord chemrecord;
+	std::string time1;
+	std::string time2;
+	if (options.lazy) {
+	    chemrecord.raw = rest;
+	    chemrecord.rawlen = line_end - rest;
+	    const char* pfield = scan_field (rest, line_end, 0, true, finder);
+	    pfield = scan_field (pfield, line_end, &time1, true, finder);
+	    if (options.adiff2 >= 0) {
+		scan_field (pfield, line_end, &time2, true, finder);
+	    }
+	} else {
+	    split_fields (rest, line_end, chemrecord.fields, finder);
+	    if (chemrecord.fields.size() > 1) {
+		time1 = chemrecord.fields[1];
+	    }
+	    if (chemrecord.fields.size() > 2) {
+		time2 = chemrecord.fields[2];
+	    }
+	}
+	double time_start = timing ? wall_seconds() : 0;
+	bool time_ok = parse_time (time1, &chemrecord.time1);
+
+// the 2nd dimension time is only used (so only parsed) with -d2, and one
+//   that is missing or not a number is just left 0 (unknown)
+
+	if (options.adiff2 < 0 || !parse_time (time2, &chemrecord.time2)) {
+	    chemrecord.time2 = 0;
+	}
+	if (timing) {
+	    time_wall += wall_seconds() - time_start;
+	    time_parse.records++;
+	}
+	if (!time_ok) {
+	    error = "error reading time value: " + time1 + "\n";
+	    return -1;
+	}
+
+// apply filters, dropping the record if it fails any of them
+
+	if (options.Time1Filter && (chemrecord.time1 < options.MinTime1 ||
+				    chemrecord.time1 > options.MaxTime1)) {
+	    continue;
+	}
+	if (options.SNFilter || options.AreaFilter) {
+	    std::string sn;
+	    std::string area;
+	    if (options.lazy) {
+		if (options.SNFilter) {
+		    nth_field (rest, line_end, sn_column, &sn, finder);
+		}
+		if (options.AreaFilter) {
+		    nth_field (rest, line_end, area_column, &area, finder);
+		}
+	    } else {
+		if (sn_column < chemrecord.fields.size()) {
+		    sn = chemrecord.fields[sn_column];
+		}
+		if (area_column < chemrecord.fields.size()) {
+		    area = chemrecord.fields[area_column];
+		}
+	    }
+	    if (options.SNFilter && !at_least (sn, options.MinSN)) {
+		continue;
+	    }
+	    if (options.AreaFilter && !at_least (area, options.MinArea)) {
+		continue;
+	    }
+	}
+	records[chemicalName].push_back(chemrecord);
+    }
+
+// Sort each chemical's records (lowest time to back) once here, rather
+//   than at the start of every alignment
+
+    RecordMap::iterator chem;
+    for (chem = records.begin(); chem != records.end(); ++chem)
+    {
+	std::sort (chem->second.begin(), chem->second.end(),
+		   ChemRecord::higher);
+    }
+
+// The time parse cpu (and events) are taken as the same fraction of the
+//   row loop's as its wall time (timing cpu for each row would cost too
+//   much)
+
+    if (timing) {
+	PhaseStats rows;
+	timer.stop (rows);
+	double fraction = rows.wall > 0 ? time_wall / rows.wall : 0;
+	tokenize.wall += rows.wall - time_wall;
+	tokenize.cpu += rows.cpu * (1 - fraction);
+	tokenize.bytes += text_end - rows_start;
+	tokenize.records += nrows;
+	time_parse.wall += time_wall;
+	time_parse.cpu += rows.cpu * fraction;
+	for (int icounter = 0; icounter < NCOUNTERS; icounter++)
+	{
+	    tokenize.counts[icounter] += rows.counts[icounter] * (1 - fraction);
+	    time_parse.counts[icounter] += rows.counts[icounter] * fraction;
+	}
+	tokenize.counted |= rows.counted;
+	time_parse.counted |= rows.counted;
+    }
+    return 0;
+}
+
+
+// A set node has three pointers and a color, and a presence node is like
+//   a record map node
+
+void Aligner::memory_usage (MemoryUsage& usage) const
+{
+    for (int ifile = 0; ifile < Files.size(); ifile++)
+    {
+	Files[ifile]->memory_usage (usage);
+    }
+    usage.headers += heap_bytes (Header) + heap_bytes (Header1) +
+	heap_bytes (Header2);
+    for (std::set<std::string>::const_iterator it = Chemicals.begin();
+	 it != Chemicals.end(); ++it)
+    {
+	usage.chemicals += sizeof (std::string) + 4 * sizeof (void*) +
+	    heap_bytes (*it);
+    }
+    usage.chemicals += Presence.bucket_count() * sizeof (void*);
+    STDPRE::unordered_map<std::string,std::vector<bool> >::const_iterator
+	present;
+    for (present = Presence.begin(); present != Presence.end(); ++present)
+    {
+	usage.chemicals += sizeof (*present) + 2 * sizeof (void*) +
+	    heap_bytes (present->first) +
+	    (present->second.capacity() + 7) / 8;
+    }
+}
+
+Aligner::Aligner (const AlignOptions& options)
+{
+    Options = options;
+    header2_required = false;
+}
+
+int Aligner::add_stream (const std::string& filename, std::istream& in)
+{
+    InputFile* file = new InputFile;
+    InputFilePtr pfile (file);
+    if (int status = file->read_stream (filename, in, Options)) {
+	errmsg = file->error;
+	return status;
+    }
+    return add_file (pfile);
+}
+
+int Aligner::add_buffer (const std::string& filename, const char* data,
+			 size_t size)
+{
+    InputFile* file = new InputFile;
+    InputFilePtr pfile (file);
+    if (int status = file->read_buffer (filename, data, size, Options)) {
+	errmsg = file->error;
+	return status;
+    }
+    return add_file (pfile);
+}
+
+int Aligner::add_file (InputFilePtr file)
+{
+    int ifile = Files.size();
+    const std::vector<std::string>& header1 = file->header1;
+    const std::vector<std::string>& header2 = file->header2;
+    header2_required = file->two_headers;
+    DataColumns.push_back(0);
+    HeaderStart.push_back(Header.size());
+
+// Create composite field names from both headers
+
+    if (header2_required)
+    {
+	std::vector<std::string> composites;
+	std::vector<std::string> suffixes;
+	composite_names (header1, header2, Options.single_header,
+			 composites, &suffixes);
+	for (int ich = 0; ich < composites.size(); ich++)
+	{
+	    Header.push_back (composites[ich]);
+	    if (ifile==0 || ich > 0) {
+		Header1.push_back (suffixes[ich]);
+		Header2.push_back (header2[ich]);
+	    }
+	    DataColumns[ifile]++;
+	}
+    }
+    DataColumns[ifile]--;  // Remove peak column
+
+// Add this file's chemicals, and in restricted mode mark this file
+//   present for each of them
+
+    RecordMap::const_iterator chem;
+    for (chem = file->records.begin(); chem != file->records.end(); ++chem)
+    {
+	Chemicals.insert (chem->first);
+	if (Options.restricted)
+	{
+	    std::vector<bool>& present = Presence[chem->first];
+	    present.resize(ifile + 1, false);
+	    present[ifile] = true;
+	}
+    }
+    Files.push_back (file);
+    return 0;
+}
+
+// Get the output header line(s)
+
+void Aligner::header_lines (std::vector<std::string>& lines) const
+{
+    const std::string& LineTerminator = Options.LineTerminator;
+    std::string outline;
+    lines.clear();
+    if (Options.single_header || !header2_required) {
+	for (int ifield = 0; ifield < Header1.size(); ifield++)
+	{
+	    if (ifield > 0) {
+		outline += ",";
+	    }
+	    outline += Header[ifield];
+	}
+	outline += LineTerminator;
+	lines.push_back (outline);
+    } else {
+	std::string lastfield = "";
+	for (int ifield = 0; ifield < Header1.size(); ifield++) {
+	    if (ifield > 0) {
+		outline += ",";
+	    }
+	    if (Header1[ifield] != lastfield) {
+		outline += Header1[ifield];
+	    }
+	    lastfield = Header1[ifield];
+	}
+	outline += LineTerminator;
+	lines.push_back (outline);
+	if (header2_required)
+	{
+	    outline.clear();
+	    for (int ifield = 0; ifield < Header2.size(); ifield++) {
+		if (ifield > 0) {
+		    outline += ",";
+		}
+		outline += Header2[ifield];
+	    }
+	    outline += LineTerminator;
+	    lines.push_back (outline);
+	}
+    }
+}
+
+void Aligner::column_names (std::vector<std::string>& names) const
+{
+    names.clear();
+    names.push_back ("Peak");
+    for (int ifile = 0; ifile < Files.size(); ifile++)
+    {
+	for (int ich = 0; ich <= DataColumns[ifile]; ich++)
+	{
+	    std::string name = Header[HeaderStart[ifile] + ich];
+	    name.erase (std::remove (name.begin(), name.end(), '"'),
+			name.end());
+	    if (ich > 0) {
+		names.push_back (name);
+	    } else if (ifile == 0) {
+		names[0] = name;  // peak column only once
+	    }
+	}
+    }
+}
+
+void Aligner::get_fields (const ChemRecord& record,
+			  std::vector<std::string>& fields) const
+{
+    if (record.raw) {
+	const char* end = record.raw + record.rawlen;
+	SpecialFinder finder (end);
+	split_fields (record.raw, end, fields, finder);
+    } else {
+	fields = record.fields;
+    }
+}
+
+void Aligner::get_field (const ChemRecord& record, int column,
+			 std::string& field) const
+{
+    field.clear();
+    if (record.raw) {
+	const char* end = record.raw + record.rawlen;
+	SpecialFinder finder (end);
+	nth_field (record.raw, end, column, &field, finder);
+    } else if (column < record.fields.size()) {
+	field = record.fields[column];
+    }
+}
+
+// Trace spans for the alignment of chemicals: consecutive chemicals are
+//   shown in batches of up to TRACE_BATCH_CHEMICALS, but one taking at
+//   least TRACE_CHEMICAL_SECONDS gets a span of its own, so that a
+//   chemical with very many records stands out
+
+#define TRACE_BATCH_CHEMICALS 256
+#define TRACE_CHEMICAL_SECONDS 0.001
+
+class ChemicalSpans {
+public:
+    ChemicalSpans (Trace* ptrace) : trace(ptrace), nbatch(0) {}
+    void start (const std::string& chemical, size_t nrecords,
+		size_t npushbacks);
+    void stop (size_t nrecords, size_t npushbacks);
+    void flush ();
+private:
+    Trace* trace;
+    const std::string* keychem;
+    double chemical_start;
+    size_t records0;
+    size_t pushbacks0;
+    int nbatch;
+    const std::string* batch_first;
+    const std::string* batch_last;
+    double batch_start;
+    double batch_end;
+    size_t batch_records;
+    size_t batch_pushbacks;
+};
+
+void ChemicalSpans::start (const std::string& chemical, size_t nrecords,
+			   size_t npushbacks)
+{
+    keychem = &chemical;
+    chemical_start = wall_seconds();
+    records0 = nrecords;
+    pushbacks0 = npushbacks;
+    if (!nbatch) {
+	batch_first = &chemical;
+	batch_start = chemical_start;
+	batch_records = 0;
+	batch_pushbacks = 0;
+    }
+}
+
+void ChemicalSpans::stop (size_t nrecords, size_t npushbacks)
+{
+    double chemical_end = wall_seconds();
+    if (chemical_end - chemical_start < TRACE_CHEMICAL_SECONDS) {
+	nbatch++;
+	batch_last = keychem;
+	batch_end = chemical_end;
+	batch_records += nrecords - records0;
+	batch_pushbacks += npushbacks - pushbacks0;
+	if (nbatch >= TRACE_BATCH_CHEMICALS) {
+	    flush();
+	}
+	return;
+    }
+    flush();
+    std::string args;
+    Trace::arg (args, "records", nrecords - records0);
+    Trace::arg (args, "pushbacks", npushbacks - pushbacks0);
+    trace->span ("align", *keychem, chemical_start, chemical_end, args);
+}
+
+void ChemicalSpans::flush ()
+{
+    if (!nbatch) {
+	return;
+    }
+    std::string args;
+    Trace::arg (args, "first", *batch_first);
+    Trace::arg (args, "last", *batch_last);
+    Trace::arg (args, "chemicals", nbatch);
+    Trace::arg (args, "records", batch_records);
+    Trace::arg (args, "pushbacks", batch_pushbacks);
+    trace->span ("align", "chemicals", batch_start, batch_end, args);
+    nbatch = 0;
+}
+
+// Alignment on both retention times (-d2)
+//
+// Each row starts from the lowest 1st dimension time not yet aligned in
+//   any file.  Every other file gives the record nearest to it, in times
+//   scaled by the tolerances, whose 1st dimension time is within <diff>
+//   above it and whose 2nd dimension time is within <diff2> of it either
+//   way.  A record without a 2nd dimension time is matched on the 1st
+//   alone.  Records are never pushed back: one that isn't taken stays for
+//   a later row.
+//
+// So that finding the nearest record doesn't mean comparing every pair,
+//   each file's records of a chemical are put in a grid whose cells are
+//   at least as wide as the tolerances, and only the (at most 2 x 3)
+//   cells that can hold a match are searched.  Records are taken out of
+//   their cells as they are aligned.  A file with only a few records of
+//   the chemical is simply searched upward from its lowest time.
+
+#define GRID_MIN_RECORDS 16          // fewer records aren't put in a grid
+#define GRID_MAX_CELLS 1000000       // cells across each time's range
+#define GRID_UNKNOWN_CELL 0x7fffffff // column of records with no time2
+
+class TimeGrid {
+public:
+    void build (const std::vector<const ChemRecord*>& records, float adiff,
+		float adiff2);
+    int lowest () const {return Lowest;}  // -1 once all are taken
+    void take (int irec);
+
+// The record nearest to anchor within the tolerances, or -1 if none
+    int nearest (const ChemRecord& anchor, float cutoff,
+		 float tolerance2) const;
+private:
+    static long long cell (double time, double width)
+	{return (long long) (time / width);}
+    static long long cell_key (long long cell1, long long cell2)
+	{return (cell1 << 32) + cell2;}
+    const std::vector<const ChemRecord*>* Records;  // highest time first
+    int Lowest;
+    bool gridded;
+    double Width1;
+    double Width2;
+    long long MaxCell1;
+    long long MaxCell2;
+    std::vector<long long> Key;  // each record's cell
+    std::vector<int> Position;   // index in its cell, -1 once taken
+    STDPRE::unordered_map<long long,std::vector<int> > Cells;
+    mutable std::vector<int> Candidates;  // kept to save allocations
+    void add_candidates (long long key) const;
+};
+
+void TimeGrid::build (const std::vector<const ChemRecord*>& records,
+		      float adiff, float adiff2)
+{
+    Records = &records;
+    Lowest = records.size() - 1;
+    gridded = records.size() >= GRID_MIN_RECORDS;
+    Position.assign (records.size(), 0);
+    Cells.clear();
+    if (!gridded) {
+	return;
+    }
+
+// Cells as wide as the widest tolerance (that at the highest time for a
+//   fraction), but not so narrow that there are too many of them
+
+    double max1 = records.front()->time1;
+    double max2 = 0;
+    int irec;
+    for (irec = 0; irec < records.size(); irec++)
+    {
+	max2 = std::max (max2, (double) records[irec]->time2);
+    }
+    Width1 = adiff < 1 ? adiff * max1 : adiff;
+    Width1 = std::max (Width1, max1 / GRID_MAX_CELLS);
+    Width2 = adiff2 < 1 ? adiff2 * max2 : adiff2;
+    Width2 = max2 > 0 ? std::max (Width2, max2 / GRID_MAX_CELLS) : 1;
+    MaxCell1 = cell (max1, Width1);
+    MaxCell2 = cell (max2, Width2);
+
+    Key.resize (records.size());
+    for (irec = 0; irec < records.size(); irec++)
+    {
+	const ChemRecord* record = records[irec];
+	long long cell2 = record->time2 > 0 ? cell (record->time2, Width2) :
+	    GRID_UNKNOWN_CELL;
+	Key[irec] = cell_key (cell (record->time1, Width1), cell2);
+	std::vector<int>& members = Cells[Key[irec]];
+	Position[irec] = members.size();
+	members.push_back (irec);
+    }
+}
+
+void TimeGrid::take (int irec)
+{
+    if (gridded) {
+	std::vector<int>& members = Cells[Key[irec]];
+	int moved = members.back();
+	members[Position[irec]] = moved;
+	Position[moved] = Position[irec];
+	members.pop_back();
+    }
+    Position[irec] = -1;
+    while (Lowest >= 0 && Position[Lowest] < 0) {
+	Lowest--;
+    }
+}
+
+void TimeGrid::add_candidates (long long key) const
+{
+    STDPRE::unordered_map<long long,std::vector<int> >::const_iterator
+	found = Cells.find (key);
+    if (found != Cells.end()) {
+	Candidates.insert (Candidates.end(), found->second.begin(),
+			   found->second.end());
+    }
+}
+
+int TimeGrid::nearest (const ChemRecord& anchor, float cutoff,
+		       float tolerance2) const
+{
+    const std::vector<const ChemRecord*>& records = *Records;
+    double scale1 = cutoff > anchor.time1 ? 1 / (cutoff - anchor.time1) : 0;
+    double scale2 = tolerance2 > 0 ? 1 / tolerance2 : 0;
+    bool known2 = anchor.time2 > 0;
+    int best = -1;
+    double best_distance = 0;
+    std::vector<int>& candidates = Candidates;
+    candidates.clear();
+
+// Without a grid, or without a 2nd dimension time to search it by, look
+//   upward from the lowest time (then the first record left is nearest)
+
+    if (!gridded || !known2) {
+	for (int irec = Lowest; irec >= 0 && records[irec]->time1 <= cutoff;
+	     irec--)
+	{
+	    if (Position[irec] >= 0) {
+		candidates.push_back (irec);
+		if (!known2) {
+		    break;
+		}
+	    }
+	}
+    } else {
+	long long first1 = cell (anchor.time1, Width1);
+	long long last1 = std::min (cell (cutoff, Width1), MaxCell1);
+	long long first2 = cell (std::max (anchor.time2 - tolerance2, 0.f),
+				 Width2);
+	long long last2 = std::min (cell (anchor.time2 + tolerance2, Width2),
+				    MaxCell2);
+	for (long long cell1 = first1; cell1 <= last1; cell1++)
+	{
+	    for (long long cell2 = first2; cell2 <= last2; cell2++)
+	    {
+		add_candidates (cell_key (cell1, cell2));
+	    }
+	    add_candidates (cell_key (cell1, GRID_UNKNOWN_CELL));
+	}
+    }
+
+// Nearest by the scaled distance, then lowest time1, then as sorted
+
+    for (int icand = 0; icand < candidates.size(); icand++)
+    {
+	int irec = candidates[icand];
+	const ChemRecord* record = records[irec];
+	if (record->time1 > cutoff) {
+	    continue;
+	}
+	double distance1 = (record->time1 - anchor.time1) * scale1;
+	double distance = distance1 * distance1;
+	if (known2 && record->time2 > 0) {
+	    if (std::abs (record->time2 - anchor.time2) > tolerance2) {
+		continue;
+	    }
+	    double distance2 = (record->time2 - anchor.time2) * scale2;
+	    distance += distance2 * distance2;
+	}
+	if (best < 0 || distance < best_distance ||
+	    (distance == best_distance &&
+	     (record->time1 < records[best]->time1 ||
+	      (record->time1 == records[best]->time1 && irec > best))))
+	{
+	    best = irec;
+	    best_distance = distance;
+	}
+    }
+    return best;
+}
+
+// Align one chemical's records on both times, adding its rows
+
+static void align_chemical_2d (const std::string& keychem,
+			       std::vector<std::vector<const ChemRecord*> >&
+			       chem_recs, std::vector<TimeGrid>& grids,
+			       float adiff, float adiff2, bool restricted,
+			       std::vector<AlignedRow>& OutputLines,
+			       size_t& iterations)
+{
+    int ninfiles = chem_recs.size();
+    int ifile;
+    for (ifile = 0; ifile < ninfiles; ifile++)
+    {
+	grids[ifile].build (chem_recs[ifile], adiff, adiff2);
+    }
+    while (1) {
+
+// The lowest time left in any file starts the row (in restricted mode,
+//   once any file has run out no further row can be complete)
+
+	int anchor_file = -1;
+	const ChemRecord* anchor = 0;
+	bool exhausted = false;
+	for (ifile = 0; ifile < ninfiles; ifile++)
+	{
+	    int ilowest = grids[ifile].lowest();
+	    if (ilowest < 0) {
+		exhausted = true;
+		continue;
+	    }
+	    const ChemRecord* lowest = chem_recs[ifile][ilowest];
+	    if (!anchor || lowest->time1 < anchor->time1) {
+		anchor = lowest;
+		anchor_file = ifile;
+	    }
+	}
+	if (!anchor || (exhausted && restricted)) {
+	    break;
+	}
+	iterations++;
+	grids[anchor_file].take (grids[anchor_file].lowest());
+	float cutoff;
+	if (adiff < 1) {
+	    cutoff = (1 + adiff) * anchor->time1;
+	} else {
+	    cutoff = anchor->time1 + adiff;
+	}
+	float tolerance2 = adiff2 < 1 ? adiff2 * anchor->time2 : adiff2;
+
+	std::vector<const ChemRecord*> row_recs (ninfiles);
+	bool unfound = false;
+	for (ifile = 0; ifile < ninfiles; ifile++)
+	{
+	    if (ifile == anchor_file) {
+		row_recs[ifile] = anchor;
+		continue;
+	    }
+	    int irec = grids[ifile].nearest (*anchor, cutoff, tolerance2);
+	    if (irec < 0) {
+		unfound = true;
+	    } else {
+		row_recs[ifile] = chem_recs[ifile][irec];
+		grids[ifile].take (irec);
+	    }
+	}
+	if (unfound && restricted) {
+	    continue;
+	}
+	OutputLines.push_back (AlignedRow());
+	AlignedRow& outrow = OutputLines.back();
+	outrow.chemical = &keychem;
+	outrow.time1 = anchor->time1;
+	outrow.records.swap (row_recs);
+    }
+}
+
+// Alignment regardless of name (--by-time)
+//
+// Peaks that are unnamed, or given different names in different files,
+//   never meet in the chemical loop.  With --by-time all records, whatever
+//   their chemical, are put in one group (with --by-class, one group for
+//   each Class, the column before the 1st dimension time), and each group
+//   is aligned as a chemical would be.  Each row is named by the chemical
+//   of its lowest record.
+
+#define BY_TIME_GROUP "(all)"  // the group's name in reports
+
+class TimeGroups {
+public:
+    void make (const Aligner& aligner, bool by_class);
+    void name_rows (std::vector<AlignedRow>& rows, size_t first) const;
+    std::set<std::string> keys;
+    std::map<std::string,std::vector<std::vector<const ChemRecord*> > >
+	records;  // by group and file, highest time first
+private:
+    class Entry {
+    public:
+	const ChemRecord* record;
+	const std::string* chemical;
+	static bool higher (const Entry& e1, const Entry& e2);
+    };
+    STDPRE::unordered_map<const ChemRecord*,const std::string*> Names;
+};
+
+// Ties are ordered by chemical and then place in the file, so that the
+//   groups don't depend on the order of the record maps
+
+bool TimeGroups::Entry::higher (const Entry& e1, const Entry& e2)
+{
+    if (e1.record->time1 != e2.record->time1) {
+	return e1.record->time1 > e2.record->time1;
+    }
+    if (*e1.chemical != *e2.chemical) {
+	return *e1.chemical > *e2.chemical;
+    }
+    return e1.record > e2.record;
+}
+
+void TimeGroups::make (const Aligner& aligner, bool by_class)
+{
+    int ninfiles = aligner.nfiles();
+    std::map<std::string,std::vector<std::vector<Entry> > > entries;
+    std::string key = BY_TIME_GROUP;
+    int ifile;
+    for (ifile = 0; ifile < ninfiles; ifile++)
+    {
+	const RecordMap& file_records = aligner.file(ifile).records;
+	for (RecordMap::const_iterator it = file_records.begin();
+	     it != file_records.end(); ++it)
+	{
+	    for (int irec = 0; irec < it->second.size(); irec++)
+	    {
+		Entry entry;
+		entry.record = &it->second[irec];
+		entry.chemical = &it->first;
+		if (by_class) {
+		    aligner.get_field (*entry.record, 0, key);
+		}
+		std::vector<std::vector<Entry> >& group = entries[key];
+		group.resize (ninfiles);
+		group[ifile].push_back (entry);
+	    }
+	}
+    }
+    std::map<std::string,std::vector<std::vector<Entry> > >::iterator group;
+    for (group = entries.begin(); group != entries.end(); ++group)
+    {
+	keys.insert (group->first);
+	std::vector<std::vector<const ChemRecord*> >& group_records =
+	    records[group->first];
+	group_records.resize (ninfiles);
+	for (ifile = 0; ifile < ninfiles; ifile++)
+	{
+	    std::vector<Entry>& file_entries = group->second[ifile];
+	    std::sort (file_entries.begin(), file_entries.end(),
+		       Entry::higher);
+	    for (int ientry = 0; ientry < file_entries.size(); ientry++)
+	    {
+		group_records[ifile].push_back (file_entries[ientry].record);
+		Names[file_entries[ientry].record] =
+		    file_entries[ientry].chemical;
+	    }
+	}
+    }
+}
+
+// Every row is named (a group's key doesn't outlive the alignment, but
+//   the chemical names are kept by the files)
+
+void TimeGroups::name_rows (std::vector<AlignedRow>& rows, size_t first)
+    const
+{
+    for (size_t irow = first; irow < rows.size(); irow++)
+    {
+	AlignedRow& row = rows[irow];
+	const ChemRecord* lowest = 0;
+	for (int ifile = 0; ifile < row.records.size(); ifile++)
+	{
+	    const ChemRecord* record = row.records[ifile];
+	    if (record && (!lowest || record->time1 < lowest->time1)) {
+		lowest = record;
+	    }
+	}
+	row.chemical = Names.find(lowest)->second;
+    }
+}
+
+// Align a group's records in one pass up the times, by the rule of the
+//   chemical loop: the lowest record left in each file joins the row
+//   unless it is beyond <diff> of the lowest of them, or closer to the
+//   second lowest of any file.  As a record that isn't taken stays the
+//   lowest in its file, nothing needs sorting again, and each pass takes
+//   at least one record, so a group of n records takes at most n passes
+//   of ninfiles steps (rather than sorting each file's records on every
+//   pass).  Only the order of records with the same time may differ
+//   from the chemical loop's.
+
+static void align_sweep (std::vector<std::vector<const ChemRecord*> >&
+			 chem_recs, float adiff, bool restricted,
+			 std::vector<AlignedRow>& OutputLines,
+			 size_t& iterations, size_t& pushbacks)
+{
+    int ninfiles = chem_recs.size();
+    int ifile;
+    while (1) {
+	float lowest_time1 = 0;
+	float second_lowest_time1 = 0;
+	bool exhausted = false;
+	for (ifile = 0; ifile < ninfiles; ifile++)
+	{
+	    const std::vector<const ChemRecord*>& records = chem_recs[ifile];
+	    if (records.empty()) {
+		exhausted = true;
+		continue;
+	    }
+	    float time1 = records.back()->time1;
+	    if (lowest_time1 == 0 || lowest_time1 > time1) {
+		lowest_time1 = time1;
+	    }
+	    if (records.size() > 1) {
+		float second_time1 = records[records.size() - 2]->time1;
+		if (second_lowest_time1 == 0 ||
+		    second_lowest_time1 > second_time1) {
+		    second_lowest_time1 = second_time1;
+		}
+	    }
+	}
+	if (lowest_time1 == 0 || (exhausted && restricted)) {
+	    break;
+	}
+	iterations++;
+	float cutoff;
+	if (adiff < 1) {
+	    cutoff = (1 + adiff) * lowest_time1;
+	} else {
+	    cutoff = lowest_time1 + adiff;
+	}
+
+	std::vector<const ChemRecord*> row_recs (ninfiles);
+	bool unfound = false;
+	for (ifile = 0; ifile < ninfiles; ifile++)
+	{
+	    std::vector<const ChemRecord*>& records = chem_recs[ifile];
+	    if (records.empty()) {
+		unfound = true;
+		continue;
+	    }
+	    const ChemRecord* test_record = records.back();
+	    if (test_record->time1 > cutoff ||
+		test_record->time1 - lowest_time1 >
+		std::abs(second_lowest_time1 - test_record->time1))
+	    {
+		pushbacks++;
+		unfound = true;
+		continue;
+	    }
+	    row_recs[ifile] = test_record;
+	    records.pop_back();
+	}
+	if (unfound && restricted) {
+	    continue;
+	}
+	OutputLines.push_back (AlignedRow());
+	AlignedRow& outrow = OutputLines.back();
+	outrow.chemical = 0;  // named by TimeGroups::name_rows
+	outrow.time1 = lowest_time1;
+	outrow.records.swap (row_recs);
+    }
+}
+
+// Sequential matching (--sequential-dp)
+//
+// The chemical loop decides each row from the lowest records left, so an
+//   early choice can push every later record of a crowded chemical into
+//   the wrong row.  Instead, the files can be matched a whole file at a
+//   time: each file in turn is matched with the rows made from the files
+//   before it, choosing the matching with the most records matched and
+//   then the least total difference from the rows' mean times.  A record
+//   may only join a row if the row's times would still be within <diff>
+//   of its lowest, and matches may not cross (a later record never joins
+//   an earlier row), as peaks elute in the same order in every file.
+//   Records left unmatched start rows of their own.
+//
+// The best non-crossing matching is the best chain of allowed (row,
+//   record) pairs increasing in both.  Because the times are sorted, the
+//   pairs allowed for a row are a short run of records found by binary
+//   search, and the chains ending before each record are kept in a
+//   Fenwick tree of prefix maxima, so a file with m records matched with
+//   r rows takes O((r + pairs) log m) rather than O(r m).
+//
+// Each file is matched optimally with the rows made before it, so two
+//   files are aligned optimally.  With more than two files, though, the
+//   rows found are not always the best over all files at once (which is
+//   a much harder problem), and can depend on the order of the files.
+
+class MatchScore {
+public:
+    MatchScore () : matches(0), deviation(0), pair(-1) {}
+    int matches;
+    double deviation;     // total difference from the rows' mean times
+    int pair;             // last pair of the chain, -1 for none
+    bool better (const MatchScore& other) const {
+	return matches > other.matches || (matches == other.matches &&
+					   deviation < other.deviation);
+    }
+};
+
+class MatchedRow {
+public:
+    MatchedRow (int ninfiles) : records(ninfiles), lowest(0), highest(0),
+				sum(0), count(0) {}
+    std::vector<const ChemRecord*> records;
+    float lowest;
+    float highest;
+    double sum;
+    int count;
+    double mean () const {return sum / count;}
+    void add (int ifile, const ChemRecord* record);
+};
+
+// Orders row numbers by the rows' mean times (so the rows, each with a
+//   vector, aren't copied to sort them)
+class MeanLower {
+public:
+    MeanLower (const std::vector<MatchedRow>& r) : rows(r) {}
+    bool operator() (int irow1, int irow2) const
+	{return rows[irow1].mean() < rows[irow2].mean();}
+private:
+    const std::vector<MatchedRow>& rows;
+};
+
+void MatchedRow::add (int ifile, const ChemRecord* record)
+{
+    if (!count || record->time1 < lowest) {
+	lowest = record->time1;
+    }
+    if (!count || record->time1 > highest) {
+	highest = record->time1;
+    }
+    records[ifile] = record;
+    sum += record->time1;
+    count++;
+}
+
+static float time_cutoff (float lowest_time1, float adiff)
+{
+    if (adiff < 1) {
+	return (1 + adiff) * lowest_time1;
+    }
+    return lowest_time1 + adiff;
+}
+
+static void align_sequential_dp (const std::string& keychem,
+				 std::vector<std::vector<const ChemRecord*> >&
+				 chem_recs, float adiff, bool restricted,
+				 std::vector<AlignedRow>& OutputLines,
+				 size_t& iterations)
+{
+    int ninfiles = chem_recs.size();
+    int ifile;
+    for (ifile = 0; ifile < ninfiles; ifile++)
+    {
+	if (restricted && chem_recs[ifile].empty()) {
+	    return;  // no row can be complete
+	}
+    }
+    std::vector<MatchedRow> rows;
+    std::vector<int> order;        // rows by mean time
+    std::vector<float> times;
+    std::vector<int> pair_rows;
+    std::vector<int> pair_records;
+    std::vector<int> pair_links;   // previous pair in the best chain
+    std::vector<MatchScore> pair_scores;
+    std::vector<MatchScore> tree;
+    std::vector<bool> matched;
+    for (ifile = 0; ifile < ninfiles; ifile++)
+    {
+	std::vector<const ChemRecord*> records (chem_recs[ifile].rbegin(),
+						chem_recs[ifile].rend());
+	int nrecords = records.size();
+	times.resize (nrecords);
+	int irec;
+	for (irec = 0; irec < nrecords; irec++)
+	{
+	    times[irec] = records[irec]->time1;
+	}
+
+// The chains of pairs, row by row: every pair of a row is scored from
+//   the chains of earlier rows (tree), then added to the tree
+
+	int nrows = rows.size();
+	order.resize (nrows);
+	for (int irow = 0; irow < nrows; irow++)
+	{
+	    order[irow] = irow;
+	}
+	std::stable_sort (order.begin(), order.end(), MeanLower (rows));
+	pair_rows.clear();
+	pair_records.clear();
+	pair_links.clear();
+	pair_scores.clear();
+	tree.assign (nrecords + 1, MatchScore());
+	MatchScore best;
+	for (int iorder = 0; iorder < nrows; iorder++)
+	{
+	    int irow = order[iorder];
+	    const MatchedRow& row = rows[irow];
+	    float low = adiff < 1 ? row.highest / (1 + adiff) :
+		row.highest - adiff;
+	    int first = std::lower_bound (times.begin(), times.end(),
+					  low * 0.999f) - times.begin();
+	    int row_pairs = pair_rows.size();
+	    for (irec = first; irec < nrecords &&
+		     times[irec] <= time_cutoff (row.lowest, adiff); irec++)
+	    {
+		float lowest = std::min (row.lowest, times[irec]);
+		float highest = std::max (row.highest, times[irec]);
+		if (highest > time_cutoff (lowest, adiff)) {
+		    continue;
+		}
+		MatchScore score;
+		for (int node = irec; node > 0; node -= node & -node)
+		{
+		    if (tree[node].better (score)) {
+			score = tree[node];
+		    }
+		}
+		pair_links.push_back (score.pair);
+		score.matches++;
+		score.deviation += std::abs (times[irec] - row.mean());
+		score.pair = pair_rows.size();
+		pair_scores.push_back (score);
+		pair_rows.push_back (irow);
+		pair_records.push_back (irec);
+	    }
+	    for (int ipair = row_pairs; ipair < pair_rows.size(); ipair++)
+	    {
+		const MatchScore& score = pair_scores[ipair];
+		for (int node = pair_records[ipair] + 1; node <= nrecords;
+		     node += node & -node)
+		{
+		    if (score.better (tree[node])) {
+			tree[node] = score;
+		    }
+		}
+		if (score.better (best)) {
+		    best = score;
+		}
+	    }
+	}
+	iterations += pair_rows.size();
+
+// Follow the best chain back, adding its records to their rows, then
+//   start new rows with the rest
+
+	matched.assign (nrecords, false);
+	for (int ipair = best.pair; ipair >= 0; ipair = pair_links[ipair])
+	{
+	    rows[pair_rows[ipair]].add (ifile, records[pair_records[ipair]]);
+	    matched[pair_records[ipair]] = true;
+	}
+	for (irec = 0; irec < nrecords; irec++)
+	{
+	    if (!matched[irec]) {
+		rows.push_back (MatchedRow (ninfiles));
+		rows.back().add (ifile, records[irec]);
+	    }
+	}
+    }
+
+    for (int irow = 0; irow < rows.size(); irow++)
+    {
+	if (restricted && rows[irow].count < ninfiles) {
+	    continue;
+	}
+	OutputLines.push_back (AlignedRow());
+	AlignedRow& outrow = OutputLines.back();
+	outrow.chemical = &keychem;
+	outrow.time1 = rows[irow].lowest;
+	outrow.records.swap (rows[irow].records);
+    }
+}
+
+// Align the records of all chemicals using one <diff>, making a row for
+//   each set of aligned records.
+//
+// Each chemical's records are worked on through a list of pointers per
+//   file, sorted and popped just as the records themselves used to be, so
+//   the files are not changed.  With -d2 they are aligned on both times
+//   by align_chemical_2d instead, or with --sequential-dp by
+//   align_sequential_dp.
+//   With --by-time, the groups of records made by TimeGroups take the
+//   place of chemicals.
+
+void Aligner::align_rows (float adiff, std::vector<AlignedRow>& OutputLines,
+			  Stats* stats) const
+{
+    PhaseTimer timer (stats && Options.perf_counters);
+    Trace* trace = Options.trace;
+    double trace_start = trace ? wall_seconds() : 0;
+    ChemicalSpans spans (trace);
+    bool costs = stats && Options.chemical_costs;
+    size_t nrecords = 0;
+    size_t pushbacks = 0;
+    bool afraction = adiff < 1;
+    bool restricted = Options.restricted;
+    int ninfiles = Files.size();
+    OutputLines.clear();
+    std::vector<std::vector<const ChemRecord*> > chem_recs (ninfiles);
+    bool two_dimensions = Options.adiff2 >= 0;
+    std::vector<TimeGrid> grids (two_dimensions ? ninfiles : 0);
+    bool by_time = Options.by_time;
+    TimeGroups groups;
+    if (by_time) {
+	groups.make (*this, Options.by_class);
+    }
+
+// iterate through each chemical seen (or group of records)
+
+    const std::set<std::string>& keys = by_time ? groups.keys : Chemicals;
+    for (std::set<std::string>::const_iterator
+	     it = keys.begin(); it != keys.end(); ++it)
+    {
+	const std::string& keychem = *it;
+
+// In restricted mode, a chemical missing from any file can never make a
+//   complete line, so skip it without aligning
+
+	if (restricted && !by_time) {
+	    const std::vector<bool>& present = Presence.find(keychem)->second;
+	    if (std::count (present.begin(), present.end(), true) <
+		ninfiles) {
+		continue;
+	    }
+	}
+
+// Get this chemical's (already sorted) records from each file
+
+	if (trace) {
+	    spans.start (keychem, nrecords, pushbacks);
+	}
+	int ifile;
+	for (ifile = 0; ifile < ninfiles; ifile++)
+	{
+	    chem_recs[ifile].clear();
+	    if (by_time) {
+		chem_recs[ifile] = groups.records[keychem][ifile];
+		nrecords += chem_recs[ifile].size();
+		continue;
+	    }
+	    RecordMap::const_iterator found = Files[ifile]->records.find(keychem);
+	    if (found != Files[ifile]->records.end()) {
+		const std::vector<ChemRecord>& records = found->second;
+		for (int irec = 0; irec < records.size(); irec++)
+		{
+		    chem_recs[ifile].push_back (&records[irec]);
+		}
+		nrecords += records.size();
+	    }
+	}
+
+// With --report-chemicals, time each chemical and count its passes
+
+	ChemicalCost* cost = 0;
+	double cost_start = 0;
+	size_t cost_pushbacks = pushbacks;
+	if (costs) {
+	    cost = &stats->chemicals[keychem];
+	    if (cost->records.empty()) {
+		for (ifile = 0; ifile < ninfiles; ifile++)
+		{
+		    cost->records.push_back (chem_recs[ifile].size());
+		}
+	    }
+	    cost_start = wall_seconds();
+	}
+	size_t iterations = 0;
+
+	size_t first_row = OutputLines.size();
+
+	bool first_pass = true;
+	bool more_data_seen = true;
+	if (two_dimensions) {
+	    align_chemical_2d (keychem, chem_recs, grids, adiff,
+			       Options.adiff2, restricted, OutputLines,
+			       iterations);
+	    more_data_seen = false;  // rows already made
+	} else if (Options.sequential_dp) {
+	    align_sequential_dp (keychem, chem_recs, adiff, restricted,
+				 OutputLines, iterations);
+	    more_data_seen = false;
+	} else if (by_time) {
+	    align_sweep (chem_recs, adiff, restricted, OutputLines, iterations,
+			 pushbacks);
+	    more_data_seen = false;
+	}
+	while (more_data_seen) {
+	    iterations++;
+
+// Likewise, once any file has run out of records for this chemical, no
+//   further line can be complete
+
+	    if (restricted) {
+		bool exhausted = false;
+		for (ifile = 0; ifile < ninfiles; ifile++)
+		{
+		    if (chem_recs[ifile].empty()) {
+			exhausted = true;
+			break;
+		    }
+		}
+		if (exhausted) {
+		    break;
+		}
+	    }
+
+// Obtain first and second lowest retention time records from all files
+
+	    std::vector<const ChemRecord*> lowest_recs;
+	    float lowest_time1 = 0;
+	    float second_lowest_time1 = 0;
+
+	    more_data_seen = false;
+	    for (ifile = 0; ifile < ninfiles; ifile++)
+	    {
+		std::vector<const ChemRecord*>& records = chem_recs[ifile];
+		if (records.size()) {
+// sort in place (lowest to back), already done for the first pass
+		    if (!first_pass) {
+			std::sort (records.begin(), records.end(),
+				   ChemRecord::higher_ptr);
+		    }
+
+// pop the lowest
+		    const ChemRecord* lowest = records.back();
+		    records.pop_back();
+		    if (lowest_time1 == 0 ||
+			lowest_time1 > lowest->time1) {
+			lowest_time1 = lowest->time1;
+		    }
+		    lowest_recs.push_back(lowest);
+
+// check the second lowest for time only (don't pop)
+
+		    if (records.begin() == records.end() ) {
+		    } else {
+			more_data_seen = true;
+			float test_lowest_time1 = records.back()->time1;
+			if (second_lowest_time1 == 0 ||
+			    second_lowest_time1 > test_lowest_time1) {
+			    second_lowest_time1 = test_lowest_time1;
+			}
+		    }
+		} else {
+		    lowest_recs.push_back(0);
+		}
+	    }
+	    first_pass = false;
+
+// Now, for each record in our lowest_recs set
+//    See if it is higher that adiff above the lowest
+//    See if it is closer to the second_lowest than lowest
+//      If either condition applies, push it back
+
+//	    std::cout << "aligning\n";
+	    for (ifile = 0; ifile < ninfiles; ifile++)
+	    {
+		const ChemRecord* test_record = lowest_recs[ifile];
+		float cutoff;
+		if (afraction) {
+		    cutoff = (1 + adiff) * lowest_time1;
+		} else {
+		    cutoff = lowest_time1 + adiff;
+		}
+		bool pushback = false;
+		if (test_record) {
+		    if (test_record->time1 > cutoff) {
+			pushback = true;
+		    } else if (test_record->time1 - lowest_time1 >
+			       std::abs(second_lowest_time1 - test_record->time1))
+		    {
+			pushback = true;
+		    }
+		    if (pushback) {
+//			std::cout << "doing pushback on record with time " <<
+//			    test_record->time1 << "\n";
+			more_data_seen = true;
+			pushbacks++;
+			chem_recs[ifile].push_back(test_record);
+			lowest_recs[ifile] = 0;
+		    }
+		}
+	    }
+
+// Keep the lowest records that haven't been pushed back as an output row
+//   (in restricted mode, only if there is one from every file)
+
+	    bool unfound = false;
+	    for (ifile=0; ifile < ninfiles; ifile++)
+	    {
+		if (!lowest_recs[ifile]) {
+		    unfound = true;
+		}
+	    }
+	    if (unfound && restricted) {
+		continue;  // rejected, so don't build (or split) the line
+	    }
+	    OutputLines.push_back (AlignedRow());
+	    AlignedRow& outrow = OutputLines.back();
+	    outrow.chemical = &keychem;
+	    outrow.time1 = lowest_time1;
+	    outrow.records.swap (lowest_recs);
+	}
+	if (by_time) {
+	    groups.name_rows (OutputLines, first_row);
+	}
+	if (cost) {
+	    cost->seconds += wall_seconds() - cost_start;
+	    cost->iterations += iterations;
+	    cost->pushbacks += pushbacks - cost_pushbacks;
+	}
+	if (trace) {
+	    spans.stop (nrecords, pushbacks);
+	}
+    }
+
+// Sort all output records by time1
+
+    if (stats) {
+	timer.stop (stats->phases[ALIGN_PHASE]);
+	stats->phases[ALIGN_PHASE].records += nrecords;
+	stats->pushbacks += pushbacks;
+	timer.start();
+    }
+    if (trace) {
+	spans.flush();
+	std::string args;
+	Trace::arg (args, "diff", adiff);
+	Trace::arg (args, "records", nrecords);
+	Trace::arg (args, "pushbacks", pushbacks);
+	double align_end = wall_seconds();
+	trace->span ("align", "align", trace_start, align_end, args);
+	trace_start = align_end;
+    }
+    std::sort (OutputLines.begin(),OutputLines.end(),AlignedRow::lower);
+    if (stats) {
+	timer.stop (stats->phases[SORT_PHASE]);
+	stats->phases[SORT_PHASE].records += OutputLines.size();
+	stats->output_bytes += AlignedRow::memory (OutputLines);
+    }
+    if (trace) {
+	std::string args;
+	Trace::arg (args, "rows", OutputLines.size());
+	trace->span ("align", "sort", trace_start, wall_seconds(), args);
+    }
+}
+
+
+void CsvSink::header (const std::string& line)
+{
+    out << line;
+    bytes += line.length();
+}
+
+// Write out the records of a row, with blanks for files having no record
+
+void CsvSink::row (const Aligner& aligner, const AlignedRow& row)
+{
+    outline = *row.chemical;
+    for (int ifile=0; ifile < aligner.nfiles(); ifile++)
+    {
+	int data_columns = aligner.data_columns (ifile);
+	if (row.records[ifile]) {
+	    const std::vector<std::string>* pfields =
+		&row.records[ifile]->fields;
+	    if (row.records[ifile]->raw) {
+		aligner.get_fields (*row.records[ifile], fields);
+		pfields = &fields;
+	    }
+	    std::vector<std::string>::const_iterator field =
+		pfields->begin();
+	    int column = 0;
+	    for (; field != pfields->end();field++)
+	    {
+// data records may have extra terminating comma (microsoft nonstandard csv)
+// only fields with names are valid
+		if (++column > data_columns) {
+		    break;
+		}
+
+		outline += ",";
+		outline += *field;
+	    }
+	} else {
+// output empty fields for this file
+	    int column = 0;
+	    while (++column <= data_columns)
+	    {
+		outline += ",";
+	    }
+	}
+    }
+    outline += LineTerminator;
+    out << outline;
+    rows++;
+    bytes += outline.length();
+}
+
+} // namespace aligncsv
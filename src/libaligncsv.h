@@ -0,0 +1,525 @@
+// Filename: libaligncsv.h
+// Purpose: library for aligning multiple csv files produced by Chromatof
+//
+// The library does everything aligncsv does except argument handling and
+//   file opening.  Inputs are given as streams or memory buffers, and the
+//   header lines and aligned rows are passed to a sink in time order.
+//
+// The aligncsv command and the R interface (aligncsv_cpp.cpp) both use
+//   this library, so there is one copy of the reading and alignment code.
+//   A sink is a template parameter of Aligner::align, so the sink's
+//   functions are called directly (and may be inlined) for each row.
+//
+// All state is held in InputFile and Aligner objects, so any number of
+//   alignments may be done in one process.  An InputFile is not changed
+//   once read, and may be shared by several Aligners.  Aligner::align does
+//   not change the Aligner, so it may be called several times (including
+//   at once from several threads) for different <diff> values.
+//
+// Typical use (see aligncsv_v4.cc):
+//
+//     aligncsv::AlignOptions options;
+//     aligncsv::Aligner aligner (options);
+//     if (aligner.add_stream ("a.csv", instream_a) ||
+//         aligner.add_stream ("b.csv", instream_b)) {
+//         std::cerr << aligner.error();
+//     }
+//     aligncsv::CsvSink sink (outstream, options.LineTerminator);
+//     aligner.align (0.01, sink);
+//
+// See aligncsv_v4.cc for the file format and alignment rules.
+//-
+
+#ifndef LIBALIGNCSV_H
+#define LIBALIGNCSV_H
+
+#define HEADER_SEPARATOR "@"  // this must not be used in column names
+#define UNIX_TERMINATOR "\n"
+
+// #define MICROSOFT_TERMINATOR ",\r\n"
+// this doesn't work.  standard library elides \r on linux systems
+// and adds it on Windows systems
+
+#define MICROSOFT_TERMINATOR ",\n"
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <istream>
+#include <ostream>
+
+// STDPRE defines the prefix needed to get C++11 functionality
+// TR1 is needed if compiler is pre C++11 (e.g. gcc 4.4.7)
+// Comment this out for C++11 compliant compilers
+// tr1 update might be required for unordered_map
+
+//#define TR1 1
+
+#ifdef TR1
+#define STDPRE std::tr1
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
+#include <tr1/memory>
+#else
+#define STDPRE std
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#endif
+
+namespace aligncsv {
+
+// A single input record
+//   Normally the data fields are split into fields when read.  In lazy
+//   mode fields is left empty and raw points to the unsplit remainder
+//   of the row (everything after the chemical) in its InputFile's text.
+class ChemRecord {
+public:
+    ChemRecord () {raw=0; rawlen=0;}
+    std::vector<std::string> fields;  // data fields following chemical
+    const char* raw;                  // lazy mode: unsplit data fields
+    int rawlen;
+    float time1;
+    float time2;                      // 0 if missing or not a number
+    static bool higher (const ChemRecord& c1, const ChemRecord& c2)
+	{return c1.time1 > c2.time1;}
+    static bool higher_ptr (const ChemRecord* c1, const ChemRecord* c2)
+	{return c1->time1 > c2->time1;}
+    int nfields () const {return fields.size();}
+};
+
+// All the records in one file, by chemical
+typedef STDPRE::unordered_map<std::string,std::vector<ChemRecord> > RecordMap;
+
+class Trace;
+
+// Options for reading and aligning files
+class AlignOptions {
+public:
+    AlignOptions ();
+    int single_header;           // -1 write one composite header
+    bool restricted;             // -r only lines found in all files
+    bool lazy;                   // -l split fields only when written
+    bool stats;                  // --stats time each phase
+    bool perf_counters;          // --perf-counters also count hardware
+				 //   events in each phase (needs stats)
+    Trace* trace;                // --trace add spans to this timeline
+    bool chemical_costs;         // --report-chemicals time each chemical's
+				 //   alignment (needs a Stats)
+    float adiff2;                // -d2 also align 2nd dimension times
+				 //   within this (a fraction if < 1, else a
+				 //   difference), < 0 (the default) if not
+				 //   (2nd dimension times are then not read)
+    bool by_time;                // --by-time align records regardless of
+				 //   chemical name
+    bool by_class;               // --by-class by time, within each Class
+    bool sequential_dp;          // --sequential-dp match file by file, in
+				 //   the order the files were added
+    bool unquoted_chemicals;     // match chemical names without their
+				 //   surrounding quotes (the R interface,
+				 //   whose data frames have lost them)
+    std::string LineTerminator;  // -m uses MICROSOFT_TERMINATOR
+
+// Record filters applied as files are read
+//   (--time1-range, --min-sn, --min-area)
+    bool Time1Filter;
+    float MinTime1;
+    float MaxTime1;
+    bool SNFilter;
+    double MinSN;
+    bool AreaFilter;
+    double MinArea;
+
+// Chemical names (without quotes) to keep or skip while reading
+//   (--chemicals, --exclude-chemicals)
+    bool IncludeFilter;
+    bool ExcludeFilter;
+    STDPRE::unordered_set<std::string> IncludeChemicals;
+    STDPRE::unordered_set<std::string> ExcludeChemicals;
+};
+
+// Time, bytes and records of each phase of reading and aligning (--stats)
+//   Times are only measured when AlignOptions::stats is set.  Wall time is
+//   elapsed time, cpu time is that of the thread doing the phase.
+
+enum Phase {OPEN_PHASE, HEADER_PHASE, TOKENIZE_PHASE, TIME_PHASE,
+	    ALIGN_PHASE, SORT_PHASE, WRITE_PHASE, NPHASES};
+
+// Events counted with --perf-counters (page faults are a software event,
+//   so are usually available where the hardware counters are not)
+enum Counter {CYCLES_COUNTER, INSTRUCTIONS_COUNTER, CACHE_MISS_COUNTER,
+	      BRANCH_MISS_COUNTER, PAGE_FAULT_COUNTER, NCOUNTERS};
+#define HARDWARE_COUNTERS 0xf  // bits of the hardware counters
+
+class PhaseStats {
+public:
+    PhaseStats () : wall(0), cpu(0), bytes(0), records(0), counted(0) {
+	for (int icounter = 0; icounter < NCOUNTERS; icounter++) {
+	    counts[icounter] = 0;
+	}
+    }
+    double wall;
+    double cpu;
+    size_t bytes;
+    size_t records;
+    double counts[NCOUNTERS];
+    unsigned counted;          // bit for each counter in counts
+    void add (const PhaseStats& other);
+};
+
+// Alignment cost of one chemical (--report-chemicals)
+class ChemicalCost {
+public:
+    ChemicalCost () : seconds(0), iterations(0), pushbacks(0) {}
+    double seconds;            // wall time
+    size_t iterations;         // passes of the pop and pushback loop
+			       //   (pairs considered with --sequential-dp)
+    size_t pushbacks;
+    std::vector<int> records;  // records in each file
+    void add (const ChemicalCost& other);  // records kept from the first
+};
+
+class Stats {
+public:
+    Stats () : pushbacks(0), output_bytes(0) {}
+    PhaseStats phases[NPHASES];
+    size_t pushbacks;          // records pushed back in the alignment loop
+    size_t output_bytes;       // memory held by the aligned rows
+    std::map<std::string,ChemicalCost> chemicals;  // if chemical_costs set
+    void add (const Stats& other);
+    void print (std::ostream& out) const;
+    void write_json (std::ostream& out) const;
+    static const char* phase_name (int phase);
+
+// Reading phases added together, e.g. for one file's ingest
+    PhaseStats ingest () const;
+
+// Print the counters of each phase (if any were counted, as print does),
+//   or a table of other sets of phases: a header then a line for each
+    void print_counters (std::ostream& out) const;
+    static void print_counter_header (std::ostream& out, const char* title);
+    static void print_counter_line (std::ostream& out, const std::string& name,
+				    const PhaseStats& phase);
+    static const char* counter_name (int counter);
+
+// Print the chemicals taking the most alignment time, at most nchemicals
+    void print_chemicals (std::ostream& out, int nchemicals) const;
+};
+
+// Processor-specific versions of the tokenizer's character search (see
+//   libaligncsv.cc).  The best one the processor supports is used unless
+//   ALIGNCSV_KERNEL names another; set_cpu_kernel changes it (e.g. for
+//   testing), returning false if not supported, and must not be called
+//   while files are being read.
+enum CpuKernel {SCALAR_KERNEL, SSE2_KERNEL, AVX2_KERNEL, AVX512_KERNEL,
+		NKERNELS};
+int cpu_kernel ();
+const char* cpu_kernel_name (int kernel);
+bool set_cpu_kernel (int kernel);
+
+// Wall and thread cpu time in seconds from an arbitrary start
+double wall_seconds ();
+double cpu_seconds ();
+
+// Event counts of the calling thread, from perf_event_open on Linux
+//   Counters that can't be opened (on other systems, in most virtual
+//   machines, or where perf_event_paranoid forbids them) are left out.
+class PerfCounters {
+public:
+    PerfCounters ();
+    ~PerfCounters ();
+
+// Open the counters, returning a bit for each one opened, and if any
+//   could not be, the reason for the first of them
+    unsigned open (std::string* reason = 0);
+    unsigned opened () const;
+    void read (double counts[NCOUNTERS]) const;  // 0 if not opened
+private:
+    int fds[NCOUNTERS];
+    PerfCounters (const PerfCounters&);            // each owns its
+    PerfCounters& operator= (const PerfCounters&); //   descriptors
+};
+
+// Adds the time (and with count set, the events) from start() (or
+//   construction) to stop() to a phase
+class PhaseTimer {
+public:
+    PhaseTimer (bool count = false) {
+	if (count) {
+	    counters.open();
+	}
+	start();
+    }
+    void start () {
+	wall0 = wall_seconds();
+	cpu0 = cpu_seconds();
+	counters.read (counts0);
+    }
+    void stop (PhaseStats& phase);
+private:
+    double wall0;
+    double cpu0;
+    PerfCounters counters;
+    double counts0[NCOUNTERS];
+};
+
+// Timeline of a run as Chrome trace events (--trace), for viewing in
+//   chrome://tracing or ui.perfetto.dev.  Spans may be added from any
+//   thread, and each thread is shown as its own track.  Spans are kept in
+//   memory until written.  When AlignOptions::trace is 0 (the default)
+//   nothing is timed.
+class Trace {
+public:
+    Trace ();
+
+// Add a span from start to end (wall_seconds values), with args made by
+//   arg(), to the calling thread's track
+    void span (const char* category, const std::string& name, double start,
+	       double end, const std::string& args = "");
+    void write (std::ostream& out) const;
+    int nspans () const {return Spans.size();}
+
+// Add a named value to the args of a span
+    static void arg (std::string& args, const char* name, double value);
+    static void arg (std::string& args, const char* name,
+		     const std::string& value);
+private:
+    class Span {
+    public:
+	const char* category;
+	std::string name;
+	std::string args;
+	int thread;
+	double start;
+	double end;
+	static bool before (const Span& s1, const Span& s2);
+    };
+    double wall0;
+    std::vector<Span> Spans;
+};
+
+// Approximate memory held by each kind of data (--memory)
+//   Heap blocks are counted, without allocator overhead.  Characters of
+//   short strings kept inside the string itself are not counted again.
+
+class MemoryUsage {
+public:
+    MemoryUsage () : index(0), records(0), fields(0), text(0), headers(0),
+		     chemicals(0), output(0) {}
+    size_t index;      // record maps: nodes, buckets and chemical keys
+    size_t records;    // ChemRecord vectors
+    size_t fields;     // data field strings
+    size_t text;       // unsplit row text (-l)
+    size_t headers;    // header names
+    size_t chemicals;  // chemical set, and presence for -r
+    size_t output;     // aligned rows
+    size_t total () const;
+    void add (const MemoryUsage& other);
+    void print (std::ostream& out) const;
+
+// Scale the usage measured for nfiles files to nprojected files.  The
+//   data of each file and each aligned row's pointers grow in proportion;
+//   the chemicals and the number of rows are assumed not to change.
+    MemoryUsage project (int nfiles, int nprojected) const;
+};
+
+// Current and peak resident memory of the process, in bytes (0 if not
+//   known on this system)
+void resident_memory (size_t& current, size_t& peak);
+
+// Read a chemical list file, one name per line (quotes optional)
+//   returns false if the file can't be read
+bool read_chemical_list (const char* filename,
+			 STDPRE::unordered_set<std::string>& names);
+
+// Header and row parsing (used by InputFile, and by the R interface)
+
+// Read one header line into header, returning the number of counted empty
+//   fields.  Empty names are stored as empty, and a trailing empty or
+//   "virtually empty" (short whitespace) field is removed.
+int read_header (const std::string& aline, std::vector<std::string>& header);
+
+// Make the composite (name@sample) column names for a file with two
+//   headers, and optionally the first header names as carried forward
+void composite_names (const std::vector<std::string>& header1,
+		      const std::vector<std::string>& header2,
+		      int single_header, std::vector<std::string>& composites,
+		      std::vector<std::string>* suffixes = 0);
+
+// Split a data row into its chemical and data fields
+void split_row (const char* begin, const char* end, std::string& chemical,
+		std::vector<std::string>& fields);
+
+// One input file, read and indexed by chemical
+//   The records for each chemical are sorted, lowest time last.
+//   Read functions return 0, or a negative status with error set:
+//     -1 bad data or filter column not found, -2 incomplete second
+//     header, -3 first and second headers different size
+class InputFile {
+public:
+    InputFile () {two_headers = false;}
+    int read_stream (const std::string& filename, std::istream& in,
+		     const AlignOptions& options);
+    int read_buffer (const std::string& filename, const char* data,
+		     size_t size, const AlignOptions& options);
+
+// Approximate number of bytes held, for limiting caches of files
+    size_t memory_used () const;
+    void memory_usage (MemoryUsage& usage) const;  // adds this file's data
+
+    std::string name;
+    std::vector<std::string> header1;  // first header as read
+    std::vector<std::string> header2;  // second header, if required
+    bool two_headers;
+    RecordMap records;
+    std::string text;                  // lazy mode: the data rows
+    std::string error;
+    Stats stats;                       // reading phases, with --stats
+private:
+    int read_text (const char* data, size_t size,
+		   const AlignOptions& options);
+    InputFile (const InputFile&);             // records may point to text
+    InputFile& operator= (const InputFile&);  //   so copying not allowed
+};
+
+typedef STDPRE::shared_ptr<const InputFile> InputFilePtr;
+
+// One set of aligned records, one (or none) from each file
+class AlignedRow {
+public:
+    const std::string* chemical;
+    float time1;                              // lowest time in the set
+    std::vector<const ChemRecord*> records;   // 0 where no record aligned
+    static bool lower (const AlignedRow& r1, const AlignedRow& r2)
+	{return r1.time1 < r2.time1;}
+    static size_t memory (const std::vector<AlignedRow>& rows);
+};
+
+class Aligner;
+
+// Receives the results of an alignment: the header lines (each with its
+//   terminator), then the aligned rows lowest time first.  Any class with
+//   these two functions may be used as a sink.  RowSink is only needed
+//   where the sink is chosen at run time.
+class RowSink {
+public:
+    virtual ~RowSink () {}
+    virtual void header (const std::string&) {}
+    virtual void row (const Aligner& aligner, const AlignedRow& row) = 0;
+};
+
+// Writes the results of an alignment as csv text
+class CsvSink {
+public:
+    CsvSink (std::ostream& outstream, const std::string& terminator)
+	: out(outstream), LineTerminator(terminator), rows(0), bytes(0) {}
+    void header (const std::string& line);
+    void row (const Aligner& aligner, const AlignedRow& row);
+    int rows_written () const {return rows;}
+    size_t bytes_written () const {return bytes;}
+private:
+    std::ostream& out;
+    std::string LineTerminator;
+    std::string outline;
+    std::vector<std::string> fields;
+    int rows;
+    size_t bytes;
+};
+
+// Aligns the records of any number of input files
+class Aligner {
+public:
+    Aligner (const AlignOptions& options);
+
+// Add a file, reading it or using one already read (with the same
+//   options).  Return 0, or the InputFile status with error() set.
+    int add_stream (const std::string& filename, std::istream& in);
+    int add_buffer (const std::string& filename, const char* data,
+		    size_t size);
+    int add_file (InputFilePtr file);
+
+// Align all files using <diff> (a fraction if < 1, else a difference)
+//   and pass the results to sink, adding the alignment, sort and write
+//   phases to stats if given.  With AlignOptions::adiff2 set, records
+//   are aligned on both retention times.
+    template <class Sink>
+    void align (float adiff, Sink& sink, Stats* stats = 0) const;
+
+// Align all files, just returning the rows (lowest time first)
+    void align_rows (float adiff, std::vector<AlignedRow>& rows,
+		     Stats* stats = 0) const;
+
+    const std::string& error () const {return errmsg;}
+    const AlignOptions& options () const {return Options;}
+    int nfiles () const {return Files.size();}
+    int nchemicals () const {return Chemicals.size();}
+    const InputFile& file (int ifile) const {return *Files[ifile];}
+    int data_columns (int ifile) const {return DataColumns[ifile];}
+    void memory_usage (MemoryUsage& usage) const;  // files and chemicals
+    void header_lines (std::vector<std::string>& lines) const;
+
+// Get a name for each output column (the chemical, then the data columns
+//   of each file), using composite names without quotes
+    void column_names (std::vector<std::string>& names) const;
+
+// Get the data fields of a record, as they would be written
+    void get_fields (const ChemRecord& record,
+		     std::vector<std::string>& fields) const;
+
+// Get one data field of a record (empty if the record has fewer fields),
+//   scanning only as far as that field in lazy mode
+    void get_field (const ChemRecord& record, int column,
+		    std::string& field) const;
+
+private:
+    AlignOptions Options;
+    std::vector<InputFilePtr> Files;
+    std::set<std::string> Chemicals;  // just the chemical names
+    std::vector<std::string> Header;
+    std::vector<std::string> Header1;
+    std::vector<std::string> Header2;
+    std::vector<int> DataColumns;
+    std::vector<int> HeaderStart;     // index of each file's names in Header
+    bool header2_required;            // last file read had two headers
+
+// Restricted mode (-r): which files each chemical was found in
+    STDPRE::unordered_map<std::string,std::vector<bool> > Presence;
+    std::string errmsg;
+};
+
+template <class Sink>
+void Aligner::align (float adiff, Sink& sink, Stats* stats) const
+{
+    std::vector<AlignedRow> OutputLines;
+    align_rows (adiff, OutputLines, stats);
+
+    PhaseTimer timer (stats && Options.perf_counters);
+    double trace_start = Options.trace ? wall_seconds() : 0;
+    std::vector<std::string> lines;
+    header_lines (lines);
+    for (int iline = 0; iline < lines.size(); iline++)
+    {
+	sink.header (lines[iline]);
+    }
+    std::vector<AlignedRow>::const_iterator row;
+    for (row = OutputLines.begin(); row != OutputLines.end(); row++)
+    {
+	sink.row (*this, *row);
+    }
+    if (stats) {
+	timer.stop (stats->phases[WRITE_PHASE]);
+	stats->phases[WRITE_PHASE].records += OutputLines.size();
+    }
+    if (Options.trace) {
+	std::string args;
+	Trace::arg (args, "rows", OutputLines.size());
+	Options.trace->span ("output", "write", trace_start, wall_seconds(),
+			     args);
+    }
+}
+
+} // namespace aligncsv
+
+#endif